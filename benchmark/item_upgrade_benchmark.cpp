@@ -0,0 +1,266 @@
+/*
+ * Credits: silviu20092
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "item_upgrade_engine.h"
+
+#ifndef ITEM_UPGRADE_MODULE_VERSION
+#define ITEM_UPGRADE_MODULE_VERSION "unknown"
+#endif
+
+namespace
+{
+    typedef ItemUpgradeEngine Engine;
+
+    /* Same fields as _ItemStat, the engine only relies on their names */
+    struct SyntheticItemStat
+    {
+        uint32 ItemStatType;
+        int32 ItemStatValue;
+    };
+    typedef std::vector<SyntheticItemStat> SyntheticItem;
+
+    /* Roughly what a live realm loads: every 3.3.5 stat type with 10 ranks, 5% more per rank */
+    constexpr uint32 STAT_TYPES = 49;
+    constexpr uint16 RANKS = 10;
+    constexpr uint32 ITEMS = 512;
+    constexpr uint32 STATS_PER_ITEM = 5;
+
+    struct SyntheticData
+    {
+        Engine::UpgradeStatContainer upgradeStats;
+        std::vector<Engine::UpgradeStatRanks> upgradeStatsByType;
+        /* Ranks sharing one upgrade percent, what FindAllUpgradeableRanks is called with */
+        std::vector<std::vector<const Engine::UpgradeStat*>> upgradesByRank;
+        /* Indexed by statId, already merged */
+        std::vector<Engine::StatRequirementContainer> requirements;
+        /* Indexed by statId, as loaded from DB: several rows per currency */
+        std::vector<Engine::StatRequirementContainer> rawRequirements;
+        std::vector<SyntheticItem> items;
+        /* Current rank of each stat type of each item, 0 when not upgraded */
+        std::vector<std::vector<uint16>> currentRanks;
+    };
+
+    SyntheticData BuildSyntheticData()
+    {
+        SyntheticData data;
+        std::mt19937 rng(20092);
+
+        data.upgradeStats.reserve(STAT_TYPES * RANKS);
+        for (uint32 statType = 0; statType < STAT_TYPES; statType++)
+            for (uint16 rank = 1; rank <= RANKS; rank++)
+                data.upgradeStats.push_back({ (uint32)data.upgradeStats.size() + 1, statType, 5.0f * rank, rank });
+
+        data.upgradeStatsByType.resize(STAT_TYPES);
+        data.upgradesByRank.resize(RANKS);
+        for (const Engine::UpgradeStat& upgradeStat : data.upgradeStats)
+        {
+            data.upgradeStatsByType[upgradeStat.statType].push_back(&upgradeStat);
+            data.upgradesByRank[upgradeStat.statRank - 1].push_back(&upgradeStat);
+        }
+
+        std::uniform_int_distribution<uint32> copper(1000, 500000);
+        std::uniform_int_distribution<uint32> points(10, 500);
+        std::uniform_int_distribution<uint32> itemEntry(40000, 40010);
+        data.rawRequirements.resize(data.upgradeStats.size() + 1);
+        for (const Engine::UpgradeStat& upgradeStat : data.upgradeStats)
+        {
+            Engine::StatRequirementContainer& reqs = data.rawRequirements[upgradeStat.statId];
+            for (uint32 i = 0; i < 3; i++)
+            {
+                reqs.push_back(Engine::UpgradeStatReq::Copper(upgradeStat.statId, copper(rng)));
+                reqs.push_back(Engine::UpgradeStatReq::Points(upgradeStat.statId, Engine::REQ_TYPE_HONOR, points(rng)));
+                reqs.push_back(Engine::UpgradeStatReq::Items(upgradeStat.statId, itemEntry(rng), 1 + i));
+            }
+            reqs.push_back(Engine::UpgradeStatReq::Points(upgradeStat.statId, Engine::REQ_TYPE_ARENA, points(rng)));
+        }
+
+        data.requirements = data.rawRequirements;
+        for (const Engine::UpgradeStat& upgradeStat : data.upgradeStats)
+            Engine::MergeStatRequirements(upgradeStat.statId, data.requirements[upgradeStat.statId], nullptr);
+
+        std::uniform_int_distribution<uint32> statType(0, STAT_TYPES - 1);
+        std::uniform_int_distribution<int32> statValue(5, 120);
+        std::uniform_int_distribution<uint32> rank(0, RANKS - 1);
+        data.items.resize(ITEMS);
+        data.currentRanks.resize(ITEMS, std::vector<uint16>(STAT_TYPES, 0));
+        for (uint32 i = 0; i < ITEMS; i++)
+        {
+            for (uint32 j = 0; j < STATS_PER_ITEM; j++)
+            {
+                uint32 type = statType(rng);
+                data.items[i].push_back({ type, statValue(rng) });
+                data.currentRanks[i][type] = rank(rng);
+            }
+        }
+
+        return data;
+    }
+
+    /* Keeps results alive so the optimizer can not drop the measured work */
+    volatile uint64 sink = 0;
+
+    struct BenchmarkResult
+    {
+        std::string name;
+        uint64 iterations;
+        uint64 totalNs;
+    };
+
+    template <typename Func>
+    BenchmarkResult Run(const std::string& name, uint64 iterations, Func&& func)
+    {
+        // warm up caches and branch predictors before measuring
+        for (uint64 i = 0; i < iterations / 10 + 1; i++)
+            sink = sink + func(i);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64 checksum = 0;
+        for (uint64 i = 0; i < iterations; i++)
+            checksum += func(i);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        sink = sink + checksum;
+
+        return { name, iterations, (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() };
+    }
+
+    std::string ToJson(const std::vector<BenchmarkResult>& results, uint64 scale)
+    {
+        std::ostringstream oss;
+        oss << "{\n";
+        oss << "  \"module\": \"mod-item-upgrade\",\n";
+        oss << "  \"version\": \"" << ITEM_UPGRADE_MODULE_VERSION << "\",\n";
+        oss << "  \"scale\": " << scale << ",\n";
+        oss << "  \"benchmarks\": [\n";
+        for (std::size_t i = 0; i < results.size(); i++)
+        {
+            const BenchmarkResult& result = results[i];
+            double nsPerOp = result.iterations > 0 ? double(result.totalNs) / result.iterations : 0.0;
+            oss << "    { \"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+                << ", \"total_ns\": " << result.totalNs << ", \"ns_per_op\": " << nsPerOp << " }";
+            oss << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        oss << "  ]\n";
+        oss << "}\n";
+        return oss.str();
+    }
+
+    void Usage(const char* program)
+    {
+        std::cerr << "Usage: " << program << " [--scale N] [--output FILE]\n"
+            << "  --scale N      multiplies the iterations of every benchmark (default 1)\n"
+            << "  --output FILE  writes the JSON results to FILE instead of stdout\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    uint64 scale = 1;
+    std::string output;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!std::strcmp(argv[i], "--scale") && i + 1 < argc)
+            scale = std::max<uint64>(1, std::stoull(argv[++i]));
+        else if (!std::strcmp(argv[i], "--output") && i + 1 < argc)
+            output = argv[++i];
+        else
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const SyntheticData data = BuildSyntheticData();
+    const uint32 upgradeStatCount = data.upgradeStats.size();
+    std::vector<BenchmarkResult> results;
+
+    results.push_back(Run("CalculateModPct", 2000000 * scale, [&](uint64 i)
+    {
+        const SyntheticItem& item = data.items[i % ITEMS];
+        return (uint64)Engine::CalculateModPct(item[i % STATS_PER_ITEM].ItemStatValue, &data.upgradeStats[i % upgradeStatCount]);
+    }));
+
+    results.push_back(Run("CalculateModPctF", 2000000 * scale, [&](uint64 i)
+    {
+        float damage = 100.0f + float(i % 400);
+        return (uint64)Engine::CalculateModPctF(damage, &data.upgradeStats[i % upgradeStatCount]);
+    }));
+
+    results.push_back(Run("MergeStatRequirements", 50000 * scale, [&](uint64 i)
+    {
+        uint32 statId = 1 + i % upgradeStatCount;
+        Engine::StatRequirementContainer reqs = data.rawRequirements[statId];
+        Engine::RequirementLimits limits{ 2147483647, 75000, 5000 };
+        Engine::MergeStatRequirements(statId, reqs, &limits);
+        return (uint64)reqs.size();
+    }));
+
+    results.push_back(Run("BuildBulkRequirements", 50000 * scale, [&](uint64 i)
+    {
+        // buying the next rank of every stat of an item at once
+        std::vector<const Engine::StatRequirementContainer*> requirements;
+        for (const SyntheticItemStat& stat : data.items[i % ITEMS])
+            requirements.push_back(&data.requirements[data.upgradeStatsByType[stat.ItemStatType][i % RANKS]->statId]);
+        return (uint64)Engine::BuildBulkRequirements(requirements, 2147483647).size();
+    }));
+
+    results.push_back(Run("FindAllUpgradeableRanks", 20000 * scale, [&](uint64 i)
+    {
+        uint32 itemIndex = i % ITEMS;
+        const std::vector<uint16>& currentRanks = data.currentRanks[itemIndex];
+        std::unordered_map<uint32, const Engine::UpgradeStat*> upgrades = Engine::FindAllUpgradeableRanks(data.upgradesByRank[i % RANKS], data.items[itemIndex],
+            data.upgradeStatsByType,
+            [](const Engine::UpgradeStat* /*stat*/) { return true; },
+            [&](uint32 statType) { return Engine::FindUpgradeStat(data.upgradeStatsByType[statType], currentRanks[statType]); });
+        return (uint64)upgrades.size();
+    }));
+
+    results.push_back(Run("FindUpgradeStat", 5000000 * scale, [&](uint64 i)
+    {
+        const Engine::UpgradeStat* upgradeStat = Engine::FindUpgradeStat(data.upgradeStatsByType[i % STAT_TYPES], uint16(i % (RANKS + 1)));
+        return upgradeStat != nullptr ? (uint64)upgradeStat->statId : 0;
+    }));
+
+    results.push_back(Run("FindStatByType", 5000000 * scale, [&](uint64 i)
+    {
+        const SyntheticItemStat* stat = Engine::FindStatByType(data.items[i % ITEMS], uint32(i % STAT_TYPES));
+        return stat != nullptr ? (uint64)stat->ItemStatValue : 0;
+    }));
+
+    results.push_back(Run("CalculateItemLevel", 500000 * scale, [&](uint64 i)
+    {
+        uint32 itemIndex = i % ITEMS;
+        const std::vector<uint16>& currentRanks = data.currentRanks[itemIndex];
+        return (uint64)Engine::CalculateItemLevel(200, data.items[itemIndex], [&](const SyntheticItemStat& stat)
+        {
+            const Engine::UpgradeStat* upgradeStat = Engine::FindUpgradeStat(data.upgradeStatsByType[stat.ItemStatType], currentRanks[stat.ItemStatType]);
+            return upgradeStat != nullptr ? Engine::CalculateModPct(stat.ItemStatValue, upgradeStat) : stat.ItemStatValue;
+        });
+    }));
+
+    std::string json = ToJson(results, scale);
+    if (output.empty())
+        std::cout << json;
+    else
+    {
+        std::ofstream file(output);
+        if (!file)
+        {
+            std::cerr << "Can not write " << output << "\n";
+            return 1;
+        }
+        file << json;
+    }
+
+    return 0;
+}
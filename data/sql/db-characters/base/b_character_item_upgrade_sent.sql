@@ -0,0 +1,6 @@
+DROP TABLE IF EXISTS `character_item_upgrade_sent`;
+CREATE TABLE `character_item_upgrade_sent`(
+	`guid` int unsigned not null,
+	`entry` int unsigned not null,
+    PRIMARY KEY (`guid`, `entry`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COLLATE=utf8mb4_unicode_ci;
\ No newline at end of file
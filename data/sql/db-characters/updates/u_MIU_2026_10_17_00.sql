@@ -0,0 +1,3 @@
+UPDATE `mod_item_upgrade_stats_req` SET `req_val2` = 0 WHERE `req_val2` IS NULL;
+ALTER TABLE `mod_item_upgrade_stats_req` MODIFY `req_val1` BIGINT NOT NULL, MODIFY `req_val2` INT NOT NULL DEFAULT 0;
+ALTER TABLE `mod_item_upgrade_stats_req_override` MODIFY `req_val1` BIGINT DEFAULT NULL, MODIFY `req_val2` INT DEFAULT NULL;
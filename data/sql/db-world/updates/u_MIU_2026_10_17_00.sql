@@ -0,0 +1,3 @@
+DELETE FROM `command` WHERE `name`='item_upgrade queue';
+INSERT INTO `command`(`name`, `security`, `help`) VALUES ('item_upgrade queue', 3, 'Syntax: .item_upgrade queue
+Shows how many upgraded item packets are waiting to be sent to logged in players (equipped, bags, bank) and how long they waited before being sent.');
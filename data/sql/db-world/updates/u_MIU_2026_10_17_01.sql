@@ -0,0 +1,5 @@
+DELETE FROM `command` WHERE `name` IN ('item_upgrade profile', 'item_upgrade profile reset');
+INSERT INTO `command`(`name`, `security`, `help`) VALUES ('item_upgrade profile', 3, 'Syntax: .item_upgrade profile
+Shows call counts and latency percentiles (in nanoseconds) of the item upgrade hot paths, recorded while ItemUpgrade.Profile is enabled.');
+INSERT INTO `command`(`name`, `security`, `help`) VALUES ('item_upgrade profile reset', 3, 'Syntax: .item_upgrade profile reset
+Clears the item upgrade hot path counters shown by .item_upgrade profile.');
@@ -0,0 +1,3 @@
+DELETE FROM `command` WHERE `name`='item_upgrade loadtest';
+INSERT INTO `command`(`name`, `security`, `help`) VALUES ('item_upgrade loadtest', 3, 'Syntax: .item_upgrade loadtest $characters [$items]
+Fabricates upgrades for $characters fake characters with $items upgraded items each (default 30), then times their login, item packets, a full data reload and their logout, with heap growth and peak memory of each step. Requires ItemUpgrade.LoadTest, blocks the world thread while running.');
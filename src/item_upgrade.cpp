@@ -5,27 +5,53 @@
 #include <numeric>
 #include <iomanip>
 #include <cmath>
+#include <chrono>
+#include <limits>
 #include "Item.h"
 #include "Config.h"
 #include "Tokenize.h"
 #include "StringConvert.h"
 #include "DatabaseEnv.h"
+#include "QueryCallback.h"
+#include "StringFormat.h"
+#include "WorldSession.h"
 #include "Log.h"
+#include "ObjectAccessor.h"
 #include "ScriptedGossip.h"
 #include "Chat.h"
 #include "SpellMgr.h"
 #include "WorldSessionMgr.h"
+#include "Metric.h"
 #include "item_upgrade.h"
+#include "item_upgrade_profiler.h"
+
+/* Object::CustomData key of the CharacterUpgradeState owned by every online player */
+static const std::string CHARACTER_UPGRADE_STATE_KEY = "ItemUpgradeCharacterState";
+
+/* Bumped whenever a CharacterUpgradeState is destroyed, see FindCharacterUpgradeState */
+static std::atomic<uint32> CharacterUpgradeStateGeneration = 0;
 
 ItemUpgrade::ItemUpgrade()
 {
     reloading = false;
+    itemPacketQueueSent = 0;
+    itemPacketQueueLatencySum = 0;
+    itemPacketQueueMaxLatency = 0;
+    itemLevelGeneration = 1;
+    for (std::atomic<uint64>& counter : metricCounters)
+        counter = 0;
+    sampledMetricCounters.fill(0);
+    metricsTimer = 0;
+    reloadStartTime = 0;
+    configReloadDeferred = false;
+
+    // readers never see a null snapshot, the real one is published by LoadFromDB
+    publishedDefinitions = std::make_unique<const UpgradeDefinitions>();
+    definitions.store(publishedDefinitions.get(), std::memory_order_release);
 }
 
 ItemUpgrade::~ItemUpgrade()
 {
-    for (auto& pageData : playerPagedData)
-        pageData.second.Reset();
 }
 
 ItemUpgrade* ItemUpgrade::instance()
@@ -41,10 +67,16 @@ bool ItemUpgrade::IsAllowedStatType(uint32 statType) const
 
 void ItemUpgrade::LoadAllowedStats(const std::string& stats)
 {
-    allowedStats.clear();
+    allowedStats = ParseAllowedStats(stats);
+}
+
+/*static*/ std::vector<uint32> ItemUpgrade::ParseAllowedStats(const std::string& stats)
+{
+    std::vector<uint32> parsedStats;
     std::vector<std::string_view> tokenized = Acore::Tokenize(stats, ',', false);
-    std::transform(tokenized.begin(), tokenized.end(), std::back_inserter(allowedStats),
+    std::transform(tokenized.begin(), tokenized.end(), std::back_inserter(parsedStats),
         [](const std::string_view& str) { return *Acore::StringTo<uint32>(str); });
+    return parsedStats;
 }
 
 bool ItemUpgrade::GetBoolConfig(ItemUpgradeBoolConfigs index) const
@@ -70,45 +102,370 @@ int32 ItemUpgrade::GetIntConfig(ItemUpgradeIntConfigs index) const
 void ItemUpgrade::LoadConfig(bool reload)
 {
     cfg.Initialize();
+    ItemUpgradeProfiler::SetEnabled(cfg.GetBoolConfig(CONFIG_ITEM_UPGRADE_PROFILE));
     LoadAllowedStats(cfg.GetStringConfig(CONFIG_ITEM_UPGRADE_ALLOWED_STATS));
     LoadWeaponUpgradePercents(cfg.GetStringConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_PERCENTS));
     if (reload)
         BuildWeaponUpgradeReqs();
 }
 
-void ItemUpgrade::LoadFromDB(bool reload)
+void ItemUpgrade::ReloadConfig()
+{
+    // .reload config can not be refused, it is applied by UpdateModifierMigration once the running migration is done
+    if (IsModifierMigrationPending())
+    {
+        configReloadDeferred = true;
+        LOG_INFO("server.loading", "Item upgrade mod config reload deferred until upgrades of online players are re-applied");
+        ChatHandler(nullptr).SendGlobalGMSysMessage("Item Upgrade module config reload deferred, modifiers of the previous reload are still being re-applied.");
+        return;
+    }
+
+    StartModifierMigration([this]() { LoadConfig(true); });
+}
+
+void ItemUpgrade::LoadFromDB()
 {
     LOG_INFO("server.loading", " ");
     LOG_INFO("server.loading", "Loading item upgrade mod custom tables...");
 
-    CleanupDB(reload);
-
-    LoadAllowedItems();
-    LoadBlacklistedItems();
-    LoadAllowedStatsItems();
-    LoadBlacklistedStatsItems();
-    LoadStatRequirements();
-    LoadStatRequirementsOverrides();
+    CleanupDB(false);
 
-    LoadUpgradeStats();
-    if (!CheckDataValidity())
+    std::unique_ptr<const UpgradeDefinitions> newDefinitions = BuildDefinitions(GetRequirementLimits());
+    if (!newDefinitions)
     {
         LOG_ERROR("server.loading", "Found data validity errors while loading item upgrade mod tables. Check the FATAL error messages and fix the issues before attempting to restart the server");
         World::StopNow(ERROR_EXIT_CODE);
         return;
     }
 
-    LoadCharacterUpgradeData();
+    // no player is online yet, nothing to migrate
+    publishedDefinitions = std::move(newDefinitions);
+    definitions.store(publishedDefinitions.get(), std::memory_order_release);
+}
 
-    LoadCharacterWeaponUpgradeData();
+bool ItemUpgrade::StartDefinitionsReload()
+{
+    if (IsDefinitionsReloadPending())
+        return false;
 
-    CreateUpgradesPctMap();
+    LOG_INFO("server.loading", "Reloading item upgrade mod custom tables...");
+    reloadStartTime = getMSTime();
+
+    // only DB queries, logging and read only core stores are touched while building, the world thread keeps running
+    pendingDefinitions = std::async(std::launch::async, [this, limits = GetRequirementLimits()]() { return BuildDefinitions(limits); });
+    return true;
+}
+
+bool ItemUpgrade::IsDefinitionsReloadPending() const
+{
+    return pendingDefinitions.valid();
 }
 
-void ItemUpgrade::LoadAllowedItems()
+void ItemUpgrade::UpdateDefinitionsReload()
 {
-    allowedItems.clear();
+    if (!IsDefinitionsReloadPending() || pendingDefinitions.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
+
+    // a config reload may have started a migration while building, the new data is published once it is done
+    if (IsModifierMigrationPending())
+        return;
+
+    std::unique_ptr<const UpgradeDefinitions> newDefinitions = pendingDefinitions.get();
+    if (!newDefinitions)
+    {
+        LOG_ERROR("server.loading", "Found data validity errors while reloading item upgrade mod tables, the previously loaded data is kept");
+        ChatHandler(nullptr).SendGlobalGMSysMessage("Item Upgrade module data reload FAILED, check the FATAL error messages. Previous data is still in use.");
+
+        // a lock taken with .item_upgrade lock is released by the reload whatever its outcome, the NPC can serve the previous data
+        SetReloading(false);
+        return;
+    }
+
+    PublishDefinitions(std::move(newDefinitions));
+
+    if (GetBoolConfig(CONFIG_ITEM_UPGRADE_METRICS))
+        METRIC_VALUE("item_upgrade_reload_time", GetMSTimeDiffToNow(reloadStartTime), METRIC_TAG("phase", "definitions"));
+
+    LOG_INFO("server.loading", "Reloaded item upgrade mod custom tables, re-applying upgrades of {} players", modifierMigration->totalPlayers);
+    ChatHandler(nullptr).SendGlobalGMSysMessage("Item Upgrade module data successfully reloaded, upgrades of online players are being re-applied.");
+}
+
+void ItemUpgrade::WaitForDefinitionsReload()
+{
+    if (IsDefinitionsReloadPending())
+        pendingDefinitions.wait();
+}
+
+const ItemUpgrade::UpgradeDefinitions& ItemUpgrade::GetDefinitions() const
+{
+    return *definitions.load(std::memory_order_acquire);
+}
+
+ItemUpgrade::RequirementLimits ItemUpgrade::GetRequirementLimits() const
+{
+    return { MAX_MONEY_AMOUNT, sWorld->getIntConfig(CONFIG_MAX_HONOR_POINTS), sWorld->getIntConfig(CONFIG_MAX_ARENA_POINTS) };
+}
+
+std::unique_ptr<const ItemUpgrade::UpgradeDefinitions> ItemUpgrade::BuildDefinitions(const RequirementLimits& limits) const
+{
+    std::unique_ptr<UpgradeDefinitions> newDefinitions = std::make_unique<UpgradeDefinitions>();
+
+    LoadAllowedItems(*newDefinitions);
+    LoadBlacklistedItems(*newDefinitions);
+    LoadAllowedStatsItems(*newDefinitions);
+    LoadBlacklistedStatsItems(*newDefinitions);
+    LoadStatRequirements(*newDefinitions, limits);
+    LoadStatRequirementsOverrides(*newDefinitions, limits);
+
+    LoadUpgradeStats(*newDefinitions);
+    if (!CheckDataValidity(*newDefinitions))
+        return nullptr;
+
+    CreateUpgradesPctMap(*newDefinitions);
+    BuildItemTemplateFlags(*newDefinitions);
+    return newDefinitions;
+}
+
+void ItemUpgrade::PublishDefinitions(std::unique_ptr<const UpgradeDefinitions> newDefinitions)
+{
+    // done here rather than while building: up to this point the NPC could still sell stats the new snapshot drops
+    FlushUpgradeJournals();
+    CleanupDB(true);
+
+    StartModifierMigration([&]()
+    {
+        // the previous snapshot stays alive until every player bound to it is migrated
+        modifierMigration->oldDefinitions = std::move(publishedDefinitions);
+        publishedDefinitions = std::move(newDefinitions);
+        definitions.store(publishedDefinitions.get(), std::memory_order_release);
+    });
 
+    // players not migrated yet keep their previous modifiers, the NPC already serves the new snapshot
+    SetReloading(false);
+}
+
+ItemUpgrade::ModifierSources ItemUpgrade::GetModifierSources() const
+{
+    ModifierSources sources;
+    sources.definitions = &GetDefinitions();
+    sources.allowedStats = &allowedStats;
+    sources.weaponUpgradeStats = &weaponUpgradeStats;
+    sources.enabled = GetBoolConfig(CONFIG_ITEM_UPGRADE_ENABLED);
+    sources.weaponDamage = GetBoolConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE);
+    return sources;
+}
+
+const ItemUpgrade::ModifierSources* ItemUpgrade::FindPendingModifierSources(const Player* player) const
+{
+    return FindPendingModifierSources(FindCharacterUpgradeState(player));
+}
+
+const ItemUpgrade::ModifierSources* ItemUpgrade::FindPendingModifierSources(const CharacterUpgradeState* characterState) const
+{
+    if (characterState == nullptr || !characterState->modifierMigrationPending)
+        return nullptr;
+
+    return &modifierMigration->oldSources;
+}
+
+ItemUpgrade::ItemModifiers ItemUpgrade::GetItemModifiers(const Item* item, const ItemUpgradeState& state, const ModifierSources& sources) const
+{
+    return GetItemModifiers(item->GetEntry(), state, sources);
+}
+
+ItemUpgrade::ItemModifiers ItemUpgrade::GetItemModifiers(uint32 entry, const ItemUpgradeState& state, const ModifierSources& sources) const
+{
+    // mirrors HandleStatModifier and HandleWeaponModifier, but against the given sources instead of the live ones
+    ItemModifiers modifiers;
+    if (!sources.enabled)
+        return modifiers;
+
+    const UpgradeDefinitions& itemDefinitions = *sources.definitions;
+    if (state.statCount > 0 && itemDefinitions.IsAllowedItem(entry) && !itemDefinitions.IsBlacklistedItem(entry))
+    {
+        for (const UpgradeStat* stat : state.stats)
+        {
+            if (stat == nullptr)
+                continue;
+
+            // resolved by id, the state may still point into the previous snapshot
+            const UpgradeStat* upgrade = itemDefinitions.FindUpgradeStat(stat->statId);
+            if (upgrade == nullptr || upgrade->statType >= MAX_ITEM_MOD || FindInContainer(*sources.allowedStats, upgrade->statType) == nullptr)
+                continue;
+
+            if (itemDefinitions.IsAllowedStatForItem(entry, upgrade) && !itemDefinitions.IsBlacklistedStatForItem(entry, upgrade))
+                modifiers.stats[upgrade->statType] = upgrade;
+        }
+    }
+
+    if (sources.weaponDamage && (state.weaponUpgrade != nullptr || state.weaponUpgradeModPct != 0.0f))
+    {
+        const UpgradeStat* weaponUpgrade = FindWeaponUpgradeStat(*sources.weaponUpgradeStats, state.weaponUpgradeModPct);
+        if (weaponUpgrade == nullptr)
+            weaponUpgrade = FindNearestWeaponUpgradeStat(*sources.weaponUpgradeStats, state.weaponUpgradeModPct);
+        modifiers.weaponUpgrade = weaponUpgrade;
+    }
+
+    return modifiers;
+}
+
+void ItemUpgrade::StartModifierMigration(const std::function<void()>& commit)
+{
+    // only one set of previous sources is kept, callers wait for the running migration instead of draining it in one update
+    ASSERT(!IsModifierMigrationPending());
+
+    modifierMigration = std::make_unique<ModifierMigration>();
+    ModifierMigration& migration = *modifierMigration;
+    migration.oldAllowedStats = allowedStats;
+    migration.oldWeaponUpgradeStats = weaponUpgradeStats;
+    migration.oldSources = GetModifierSources();
+    migration.oldSources.allowedStats = &migration.oldAllowedStats;
+    migration.oldSources.weaponUpgradeStats = &migration.oldWeaponUpgradeStats;
+    migration.startTime = getMSTime();
+
+    VisitCharacterUpgradeStates([&](CharacterUpgradeState& characterState)
+    {
+        if (!characterState.items.empty())
+        {
+            migration.pendingPlayers.insert(characterState.guid);
+            characterState.modifierMigrationPending = true;
+        }
+
+        // paged data may point into replaced data
+        characterState.pagedData.reloaded = true;
+    });
+    migration.totalPlayers = migration.pendingPlayers.size();
+
+    commit();
+    itemLevelGeneration++;
+
+    // keys already hold every upgradable value, emptied anyway so nothing serialized before a reload is served after it
+    ClearItemQueryCache();
+}
+
+bool ItemUpgrade::IsModifierMigrationPending() const
+{
+    return modifierMigration != nullptr;
+}
+
+std::pair<uint32, uint32> ItemUpgrade::GetModifierMigrationProgress() const
+{
+    if (!modifierMigration)
+        return std::make_pair(0, 0);
+
+    return std::make_pair(modifierMigration->totalPlayers - (uint32)modifierMigration->pendingPlayers.size(), modifierMigration->totalPlayers);
+}
+
+void ItemUpgrade::UpdateModifierMigration()
+{
+    if (modifierMigration)
+        ProcessModifierMigration(GetIntConfig(CONFIG_ITEM_UPGRADE_RELOAD_PLAYERS_PER_UPDATE), GetIntConfig(CONFIG_ITEM_UPGRADE_RELOAD_MICROSECONDS_PER_UPDATE));
+
+    if (!modifierMigration && configReloadDeferred)
+    {
+        configReloadDeferred = false;
+        ReloadConfig();
+    }
+}
+
+void ItemUpgrade::FinishModifierMigration()
+{
+    if (modifierMigration)
+        ProcessModifierMigration(0, 0);
+}
+
+void ItemUpgrade::ProcessModifierMigration(uint32 maxPlayers, uint32 maxMicroseconds)
+{
+    ModifierMigration& migration = *modifierMigration;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint32 processed = 0;
+    while (!migration.pendingPlayers.empty())
+    {
+        MigratePlayerModifiers(*migration.pendingPlayers.begin());
+        processed++;
+
+        if (maxPlayers > 0 && processed >= maxPlayers)
+            break;
+
+        if (maxMicroseconds > 0 && std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() >= maxMicroseconds)
+            break;
+    }
+
+    if (!migration.pendingPlayers.empty())
+        return;
+
+    uint32 elapsed = GetMSTimeDiffToNow(migration.startTime);
+    LOG_INFO("server.loading", "Re-applied item upgrades of {} players ({} items, skipped {} unchanged items) out of {} players in {} ms",
+        migration.players, migration.items, migration.skippedItems, migration.totalPlayers, elapsed);
+    ChatHandler(nullptr).SendGlobalGMSysMessage(Acore::StringFormat("Item Upgrade modifiers re-applied for {} of {} players ({} items, {} unchanged items skipped) in {} ms.",
+        migration.players, migration.totalPlayers, migration.items, migration.skippedItems, elapsed).c_str());
+
+    if (GetBoolConfig(CONFIG_ITEM_UPGRADE_METRICS))
+        METRIC_VALUE("item_upgrade_reload_time", elapsed, METRIC_TAG("phase", "migration"));
+
+    modifierMigration.reset();
+}
+
+void ItemUpgrade::MigratePlayerModifiers(uint32 guid)
+{
+    ModifierMigration& migration = *modifierMigration;
+
+    // the player may still be loading and not be in world yet, its state has to be remapped anyway
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(guid);
+    if (characterState == nullptr)
+    {
+        migration.pendingPlayers.erase(guid);
+        return;
+    }
+
+    // modifiers have to be removed with the values they were applied with, so while the player is still pending
+    ModifierSources newSources = GetModifierSources();
+    Player* player = ObjectAccessor::FindPlayerByLowGUID(guid);
+    std::vector<Item*> changedEquippedItems;
+    bool playerChanged = false;
+    if (player)
+    {
+        for (auto& indexed : characterState->items)
+        {
+            Item* item = FindIndexedItem(player, indexed.first, indexed.second.pos);
+            if (!item)
+                continue;
+
+            if (GetItemModifiers(item, indexed.second, migration.oldSources) == GetItemModifiers(item, indexed.second, newSources))
+            {
+                migration.skippedItems++;
+                continue;
+            }
+
+            playerChanged = true;
+            migration.items++;
+            if (item->IsEquipped())
+            {
+                player->_ApplyItemMods(item, item->GetSlot(), false);
+                changedEquippedItems.push_back(item);
+            }
+        }
+    }
+
+    // from here on the hooks use the live sources for this player
+    migration.pendingPlayers.erase(guid);
+    characterState->modifierMigrationPending = false;
+    for (auto& indexed : characterState->items)
+        RemapItemUpgradeState(indexed.second);
+
+    for (Item* item : changedEquippedItems)
+        player->_ApplyItemMods(item, item->GetSlot(), true);
+
+    if (playerChanged)
+    {
+        migration.players++;
+        UpdateVisualCache(player);
+    }
+}
+
+void ItemUpgrade::LoadAllowedItems(UpgradeDefinitions& newDefinitions) const
+{
     QueryResult result = CharacterDatabase.Query("SELECT entry FROM mod_item_upgrade_allowed_items");
     if (!result)
         return;
@@ -125,14 +482,12 @@ void ItemUpgrade::LoadAllowedItems()
             continue;
         }
 
-        allowedItems.insert(entry);
+        newDefinitions.allowedItems.insert(entry);
     } while (result->NextRow());
 }
 
-void ItemUpgrade::LoadAllowedStatsItems()
+void ItemUpgrade::LoadAllowedStatsItems(UpgradeDefinitions& newDefinitions) const
 {
-    allowedStatItems.clear();
-
     QueryResult result = CharacterDatabase.Query("SELECT stat_id, entry FROM mod_item_upgrade_allowed_stats_items");
     if (!result)
         return;
@@ -150,14 +505,12 @@ void ItemUpgrade::LoadAllowedStatsItems()
             continue;
         }
 
-        allowedStatItems[stat_id].insert(entry);
+        newDefinitions.allowedStatItems[stat_id].insert(entry);
     } while (result->NextRow());
 }
 
-void ItemUpgrade::LoadBlacklistedItems()
+void ItemUpgrade::LoadBlacklistedItems(UpgradeDefinitions& newDefinitions) const
 {
-    blacklistedItems.clear();
-
     QueryResult result = CharacterDatabase.Query("SELECT entry FROM mod_item_upgrade_blacklisted_items");
     if (!result)
         return;
@@ -174,14 +527,12 @@ void ItemUpgrade::LoadBlacklistedItems()
             continue;
         }
 
-        blacklistedItems.insert(entry);
+        newDefinitions.blacklistedItems.insert(entry);
     } while (result->NextRow());
 }
 
-void ItemUpgrade::LoadBlacklistedStatsItems()
+void ItemUpgrade::LoadBlacklistedStatsItems(UpgradeDefinitions& newDefinitions) const
 {
-    blacklistedStatItems.clear();
-
     QueryResult result = CharacterDatabase.Query("SELECT stat_id, entry FROM mod_item_upgrade_blacklisted_stats_items");
     if (!result)
         return;
@@ -199,11 +550,11 @@ void ItemUpgrade::LoadBlacklistedStatsItems()
             continue;
         }
 
-        blacklistedStatItems[stat_id].insert(entry);
+        newDefinitions.blacklistedStatItems[stat_id].insert(entry);
     } while (result->NextRow());
 }
 
-void ItemUpgrade::CleanupDB(bool reload)
+void ItemUpgrade::CleanupDB(bool reload) const
 {
     CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
     trans->Append("DELETE FROM mod_item_upgrade_stats_req WHERE stat_id NOT IN (SELECT id FROM mod_item_upgrade_stats)");
@@ -219,73 +570,22 @@ void ItemUpgrade::CleanupDB(bool reload)
     CharacterDatabase.DirectCommitTransaction(trans);
 }
 
-void ItemUpgrade::MergeStatRequirements(std::unordered_map<uint32, StatRequirementContainer>& statRequirementMap, bool validate)
+void ItemUpgrade::MergeStatRequirements(std::unordered_map<uint32, StatRequirementContainer>& statRequirementMap, const RequirementLimits* limits) const
 {
     for (auto& statPair : statRequirementMap)
     {
-        StatRequirementContainer newStatReq;
-
-        float copperTotal = std::accumulate(statPair.second.begin(), statPair.second.end(), 0.0f,
-            [](float a, const UpgradeStatReq& req) { return a + (req.reqType == REQ_TYPE_COPPER ? req.reqVal1 : 0.0f); });
-        if (copperTotal > 0.0f)
-        {
-            int32 val = static_cast<int32>(copperTotal);
-            if (validate && (val < 1 || val > MAX_MONEY_AMOUNT))
-                LOG_ERROR("sql.sql", "Stat requirement has invalid total copper amount for stat id {}, skip", statPair.first);
-            else
-                newStatReq.push_back(UpgradeStatReq(statPair.first, REQ_TYPE_COPPER, copperTotal));
-        }
-
-        float honorTotal = std::accumulate(statPair.second.begin(), statPair.second.end(), 0.0f,
-            [](float a, const UpgradeStatReq& req) { return a + (req.reqType == REQ_TYPE_HONOR ? req.reqVal1 : 0.0f); });
-        if (honorTotal > 0.0f)
-        {
-            int32 val = static_cast<int32>(honorTotal);
-            if (validate && (val < 1 || val > sWorld->getIntConfig(CONFIG_MAX_HONOR_POINTS)))
-                LOG_ERROR("sql.sql", "Stat requirement has invalid total honor points for stat id {}, skip", statPair.first);
-            else
-                newStatReq.push_back(UpgradeStatReq(statPair.first, REQ_TYPE_HONOR, honorTotal));
-        }
-
-        float arenaTotal = std::accumulate(statPair.second.begin(), statPair.second.end(), 0.0f,
-            [](float a, const UpgradeStatReq& req) { return a + (req.reqType == REQ_TYPE_ARENA ? req.reqVal1 : 0.0f); });
-        if (arenaTotal > 0.0f)
-        {
-            int32 val = static_cast<int32>(arenaTotal);
-            if (validate && (val < 1 || val > sWorld->getIntConfig(CONFIG_MAX_ARENA_POINTS)))
-                LOG_ERROR("sql.sql", "Stat requirement has invalid total arena points for stat id {}, skip", statPair.first);
-            else
-                newStatReq.push_back(UpgradeStatReq(statPair.first, REQ_TYPE_ARENA, arenaTotal));
-        }
-
-        std::unordered_map<uint32, uint32> itemCountMap;
-        for (const UpgradeStatReq& req : statPair.second)
-        {
-            if (req.reqType != REQ_TYPE_ITEM)
-                continue;
-
-            itemCountMap[(uint32)req.reqVal1] += (uint32)req.reqVal2;
-        }
-        if (!itemCountMap.empty())
-        {
-            for (const auto& itemPair : itemCountMap)
-                newStatReq.push_back(UpgradeStatReq(statPair.first, REQ_TYPE_ITEM, itemPair.first, itemPair.second));
-        }
-
-        StatRequirementContainer::const_iterator citer = std::find_if(statPair.second.begin(), statPair.second.end(),
-            [&](const UpgradeStatReq& req) { return req.reqType == REQ_TYPE_NONE; });
-        if (citer != statPair.second.end()) {
-            newStatReq.push_back(UpgradeStatReq(statPair.first, REQ_TYPE_NONE));
-        }
-
-        statPair.second = newStatReq;
+        uint8 rejected = ItemUpgradeEngine::MergeStatRequirements(statPair.first, statPair.second, limits);
+        if (rejected & MERGE_REJECTED_COPPER)
+            LOG_ERROR("sql.sql", "Stat requirement has invalid total copper amount for stat id {}, skip", statPair.first);
+        if (rejected & MERGE_REJECTED_HONOR)
+            LOG_ERROR("sql.sql", "Stat requirement has invalid total honor points for stat id {}, skip", statPair.first);
+        if (rejected & MERGE_REJECTED_ARENA)
+            LOG_ERROR("sql.sql", "Stat requirement has invalid total arena points for stat id {}, skip", statPair.first);
     }
 }
 
-void ItemUpgrade::LoadStatRequirements()
+void ItemUpgrade::LoadStatRequirements(UpgradeDefinitions& newDefinitions, const RequirementLimits& limits) const
 {
-    baseStatRequirements.clear();
-
     QueryResult result = CharacterDatabase.Query("SELECT id, stat_id, req_type, req_val1, req_val2 FROM mod_item_upgrade_stats_req");
     if (!result)
         return;
@@ -301,26 +601,19 @@ void ItemUpgrade::LoadStatRequirements()
             LOG_ERROR("sql.sql", "Table `mod_item_upgrade_stats_req` has invalid `req_type` {}, skip", reqType);
             continue;
         }
-        float reqVal1 = fields[3].Get<float>();
-        float reqVal2 = fields[4].Get<float>();
-        if (!ValidateReq(fields[0].Get<uint32>(), (UpgradeStatReqType)reqType, reqVal1, reqVal2, "mod_item_upgrade_stats_req"))
+        int64 reqVal1 = fields[3].Get<int64>();
+        int64 reqVal2 = fields[4].Get<int64>();
+        if (!ValidateReq(fields[0].Get<uint32>(), (UpgradeStatReqType)reqType, reqVal1, reqVal2, "mod_item_upgrade_stats_req", limits))
             continue;
 
-        UpgradeStatReq statReq;
-        statReq.statId = statId;
-        statReq.reqType = (UpgradeStatReqType)reqType;
-        statReq.reqVal1 = reqVal1;
-        statReq.reqVal2 = reqVal2;
-        baseStatRequirements[statId].push_back(statReq);
+        newDefinitions.baseStatRequirements[statId].push_back(MakeStatReq(statId, (UpgradeStatReqType)reqType, reqVal1, reqVal2));
     } while (result->NextRow());
 
-    MergeStatRequirements(baseStatRequirements);
+    MergeStatRequirements(newDefinitions.baseStatRequirements, &limits);
 }
 
-void ItemUpgrade::LoadStatRequirementsOverrides()
+void ItemUpgrade::LoadStatRequirementsOverrides(UpgradeDefinitions& newDefinitions, const RequirementLimits& limits) const
 {
-    overrideStatRequirements.clear();
-
     QueryResult result = CharacterDatabase.Query("SELECT id, stat_id, item_entry, req_type, req_val1, req_val2 FROM mod_item_upgrade_stats_req_override");
     if (!result)
         return;
@@ -342,134 +635,361 @@ void ItemUpgrade::LoadStatRequirementsOverrides()
             LOG_ERROR("sql.sql", "Table `mod_item_upgrade_stats_req_override` has invalid `item_entry` {}, skip", entry);
             continue;
         }
-        float reqVal1 = fields[4].Get<float>();
-        float reqVal2 = fields[5].Get<float>();
-        if (!ValidateReq(fields[0].Get<uint32>(), (UpgradeStatReqType)reqType, reqVal1, reqVal2, "mod_item_upgrade_stats_req_override"))
+        int64 reqVal1 = fields[4].Get<int64>();
+        int64 reqVal2 = fields[5].Get<int64>();
+        if (!ValidateReq(fields[0].Get<uint32>(), (UpgradeStatReqType)reqType, reqVal1, reqVal2, "mod_item_upgrade_stats_req_override", limits))
             continue;
 
-        UpgradeStatReq statReq;
-        statReq.statId = statId;
-        statReq.reqType = (UpgradeStatReqType)reqType;
-        statReq.reqVal1 = reqVal1;
-        statReq.reqVal2 = reqVal2;
-
-        overrideStatRequirements[entry][statId].push_back(statReq);
+        newDefinitions.overrideStatRequirements[entry][statId].push_back(MakeStatReq(statId, (UpgradeStatReqType)reqType, reqVal1, reqVal2));
     } while (result->NextRow());
 
-    for (auto& pair : overrideStatRequirements)
-        MergeStatRequirements(pair.second);
+    for (auto& pair : newDefinitions.overrideStatRequirements)
+        MergeStatRequirements(pair.second, &limits);
 }
 
-void ItemUpgrade::LoadUpgradeStats()
+void ItemUpgrade::LoadUpgradeStats(UpgradeDefinitions& newDefinitions) const
 {
-    upgradeStatList.clear();
+    UpgradeStatContainer& upgradeStatList = newDefinitions.upgradeStatList;
 
     QueryResult result = CharacterDatabase.Query("SELECT id, stat_type, stat_mod_pct, stat_rank FROM mod_item_upgrade_stats");
-    if (!result)
-        return;
+    if (result)
+    {
+        upgradeStatList.reserve(result->GetRowCount());
+        do
+        {
+            Field* fields = result->Fetch();
+
+            uint32 id = fields[0].Get<uint32>();
+            uint32 statType = fields[1].Get<uint32>();
+            float statModPct = fields[2].Get<float>();
+            uint16 statRank = fields[3].Get<uint16>();
+
+            UpgradeStat upgradeStat;
+            upgradeStat.statId = id;
+            upgradeStat.statType = statType;
+            upgradeStat.statModPct = statModPct;
+            upgradeStat.statRank = statRank;
+            upgradeStatList.push_back(upgradeStat);
+        } while (result->NextRow());
+    }
 
-    do
+    // build the lookup tables only after the list is complete, the snapshot is never modified afterwards so pointers into it stay valid
+    for (const UpgradeStat& upgradeStat : upgradeStatList)
     {
-        Field* fields = result->Fetch();
+        if (upgradeStat.statId >= newDefinitions.upgradeStatById.size())
+            newDefinitions.upgradeStatById.resize(upgradeStat.statId + 1, nullptr);
+        newDefinitions.upgradeStatById[upgradeStat.statId] = &upgradeStat;
 
-        uint32 id = fields[0].Get<uint32>();
-        uint32 statType = fields[1].Get<uint32>();
-        float statModPct = fields[2].Get<float>();
-        uint16 statRank = fields[3].Get<uint16>();
-
-        UpgradeStat upgradeStat;
-        upgradeStat.statId = id;
-        upgradeStat.statType = statType;
-        upgradeStat.statModPct = statModPct;
-        upgradeStat.statRank = statRank;
-        upgradeStatList.push_back(upgradeStat);
-    } while (result->NextRow());
+        // invalid types and ranks are reported by CheckDataValidity
+        if (upgradeStat.statType >= MAX_ITEM_MOD || upgradeStat.statRank == 0)
+            continue;
+
+        std::vector<const UpgradeStat*>& ranks = newDefinitions.upgradeStatsByType[upgradeStat.statType];
+        if (upgradeStat.statRank > ranks.size())
+            ranks.resize(upgradeStat.statRank, nullptr);
+        ranks[upgradeStat.statRank - 1] = &upgradeStat;
+    }
 }
 
-void ItemUpgrade::LoadCharacterUpgradeData()
+void ItemUpgrade::LoadCharacterUpgradeData(Player* player)
 {
-    characterUpgradeData.clear();
+    uint32 guidLow = player->GetGUID().GetCounter();
 
-    uint32 oldMSTime = getMSTime();
+    // the Player owns the state from now on, it is unregistered when the player is destroyed
+    CharacterUpgradeState* characterState = new CharacterUpgradeState(guidLow);
+    player->CustomData.Set(CHARACTER_UPGRADE_STATE_KEY, characterState);
+    RegisterCharacterUpgradeState(characterState);
 
-    QueryResult result = CharacterDatabase.Query("SELECT guid, item_guid, stat_id FROM character_item_upgrade");
-    if (!result)
-    {
-        LOG_INFO("server.loading", ">> Loaded 0 character item upgrades.");
-        LOG_INFO("server.loading", " ");
+    ObjectGuid guid = player->GetGUID();
+    WorldSession* session = player->GetSession();
+
+    // callbacks are owned by the session and processed on the world thread, re-check the player in case of a relog
+    session->GetQueryProcessor().AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormat("SELECT item_guid, stat_id FROM character_item_upgrade WHERE guid = {}", guidLow))
+        .WithCallback([this, session, guid](QueryResult result)
+        {
+            Player* player = session->GetPlayer();
+            if (player != nullptr && player->GetGUID() == guid)
+                LoadCharacterItemUpgrades(player, result);
+        }));
+
+    session->GetQueryProcessor().AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormat("SELECT item_guid, upgrade_perc FROM character_weapon_upgrade WHERE guid = {}", guidLow))
+        .WithCallback([this, session, guid](QueryResult result)
+        {
+            Player* player = session->GetPlayer();
+            if (player != nullptr && player->GetGUID() == guid)
+                LoadCharacterWeaponUpgrades(player, result);
+        }));
+
+    session->GetQueryProcessor().AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormat("SELECT entry FROM character_item_upgrade_sent WHERE guid = {}", guidLow))
+        .WithCallback([this, session, guid](QueryResult result)
+        {
+            Player* player = session->GetPlayer();
+            if (player != nullptr && player->GetGUID() == guid)
+                LoadCharacterClientEntries(player, result);
+        }));
+}
+
+void ItemUpgrade::LoadCharacterItemUpgrades(Player* player, QueryResult result)
+{
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    if (characterState == nullptr || characterState->itemUpgradesLoaded)
         return;
-    }
 
-    uint32 count = 0;
-    do
+    std::vector<std::pair<ObjectGuid::LowType, const UpgradeStat*>> upgrades;
+    if (result)
     {
-        Field* fields = result->Fetch();
+        upgrades.reserve(result->GetRowCount());
+        do
+        {
+            Field* fields = result->Fetch();
+
+            ObjectGuid::LowType itemGuid = fields[0].Get<uint32>();
+            uint32 statId = fields[1].Get<uint32>();
 
-        uint32 guidLow = fields[0].Get<uint32>();
-        ObjectGuid itemGuid = ObjectGuid::Create<HighGuid::Item>(fields[1].Get<uint32>());
-        uint32 statId = fields[2].Get<uint32>();
+            const UpgradeStat* upgradeStat = FindUpgradeStat(statId);
+            if (upgradeStat == nullptr)
+            {
+                LOG_ERROR("sql.sql", "Table `character_item_upgrade` has invalid `stat_id` {}, this should never happen, skip", statId);
+                continue;
+            }
+
+            upgrades.emplace_back(itemGuid, upgradeStat);
+        } while (result->NextRow());
+    }
 
-        CharacterUpgrade characterUpgrade;
-        characterUpgrade.guid = guidLow;
-        characterUpgrade.itemGuid = itemGuid;
-        characterUpgrade.upgradeStat = FindUpgradeStat(statId);
-        if (characterUpgrade.upgradeStat == nullptr)
+    // equipped items already had their mods applied while the player was loading, so they are re-applied with the upgrades
+    std::vector<Item*> equippedItems;
+    VisitPlayerItems(player, INVENTORY_SCOPE_EQUIPPED, [&](Item* item, InventoryScope /*scope*/)
+    {
+        if (std::any_of(upgrades.begin(), upgrades.end(), [&](const auto& upgrade) { return upgrade.first == item->GetGUID().GetCounter(); }))
         {
-            LOG_ERROR("sql.sql", "Table `character_item_upgrade` has invalid `stat_id` {}, this should never happen, skip", statId);
-            continue;
+            player->_ApplyItemMods(item, item->GetSlot(), false);
+            equippedItems.push_back(item);
         }
-        characterUpgradeData[guidLow].push_back(characterUpgrade);
-        count++;
-    } while (result->NextRow());
+    });
 
-    LOG_INFO("server.loading", ">> Loaded {} character item upgrades in {} ms", count, GetMSTimeDiffToNow(oldMSTime));
-    LOG_INFO("server.loading", " ");
+    for (const auto& upgrade : upgrades)
+    {
+        ItemUpgradeState& state = GetOrCreateItemUpgradeState(player, upgrade.first);
+        SetItemUpgradeStat(state, upgrade.second);
+    }
+    characterState->itemUpgradesLoaded = true;
+
+    for (Item* item : equippedItems)
+        player->_ApplyItemMods(item, item->GetSlot(), true);
 }
 
-void ItemUpgrade::LoadCharacterWeaponUpgradeData()
+void ItemUpgrade::LoadCharacterWeaponUpgrades(Player* player, QueryResult result)
 {
-    characterWeaponUpgradeData.clear();
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    if (characterState == nullptr || characterState->weaponUpgradesLoaded)
+        return;
 
-    uint32 oldMSTime = getMSTime();
+    std::vector<std::pair<ObjectGuid::LowType, float>> upgrades;
+    if (result)
+    {
+        upgrades.reserve(result->GetRowCount());
+        do
+        {
+            Field* fields = result->Fetch();
+            upgrades.emplace_back(fields[0].Get<uint32>(), fields[1].Get<float>());
+        } while (result->NextRow());
+    }
 
-    QueryResult result = CharacterDatabase.Query("SELECT guid, item_guid, upgrade_perc FROM character_weapon_upgrade");
-    if (!result)
+    std::vector<Item*> equippedItems;
+    VisitPlayerItems(player, INVENTORY_SCOPE_EQUIPPED, [&](Item* item, InventoryScope /*scope*/)
     {
-        LOG_INFO("server.loading", ">> Loaded 0 character weapon item upgrades.");
-        LOG_INFO("server.loading", " ");
+        if (std::any_of(upgrades.begin(), upgrades.end(), [&](const auto& upgrade) { return upgrade.first == item->GetGUID().GetCounter(); }))
+        {
+            player->_ApplyItemMods(item, item->GetSlot(), false);
+            equippedItems.push_back(item);
+        }
+    });
+
+    for (const auto& upgrade : upgrades)
+    {
+        float perc = upgrade.second;
+        const UpgradeStat* weaponUpgrade = FindWeaponUpgradeStat(perc);
+        if (weaponUpgrade == nullptr)
+        {
+            weaponUpgrade = FindNearestWeaponUpgradeStat(perc);
+            if (weaponUpgrade == nullptr) {
+                LOG_ERROR("sql.sql", "Table `character_weapon_upgrade` has invalid `upgrade_perc` {}, there is no other near percent that can be chosen, skip", perc);
+                continue;
+            }
+            else
+                LOG_INFO("sql.sql", "Table `character_weapon_upgrade` has invalid `upgrade_perc` {} but a near percentage was chosen: {}", perc, weaponUpgrade->statModPct);
+        }
+
+        ItemUpgradeState& state = GetOrCreateItemUpgradeState(player, upgrade.first);
+        state.weaponUpgrade = weaponUpgrade;
+        state.weaponUpgradeModPct = perc;
+    }
+    characterState->weaponUpgradesLoaded = true;
+
+    for (Item* item : equippedItems)
+        player->_ApplyItemMods(item, item->GetSlot(), true);
+}
+
+void ItemUpgrade::LoadCharacterClientEntries(Player* player, QueryResult result)
+{
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    if (characterState == nullptr || characterState->clientEntriesLoaded)
         return;
+
+    if (result)
+    {
+        do
+        {
+            Field* fields = result->Fetch();
+            characterState->upgradedClientEntries.insert(fields[0].Get<uint32>());
+        } while (result->NextRow());
     }
+    characterState->clientEntriesLoaded = true;
+}
 
-    uint32 count = 0;
-    do
+void ItemUpgrade::UnloadCharacterUpgradeData(Player* player)
+{
+    FlushUpgradeJournal(player);
+    HandleCharacterRemove(player->GetGUID().GetCounter());
+    player->CustomData.Erase(CHARACTER_UPGRADE_STATE_KEY);
+}
+
+bool ItemUpgrade::IsCharacterUpgradeDataLoaded(const Player* player) const
+{
+    const CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    return characterState != nullptr && characterState->IsLoaded();
+}
+
+bool ItemUpgrade::IsWriteBehind(const Player* player) const
+{
+    if (GetBoolConfig(CONFIG_ITEM_UPGRADE_WRITE_BEHIND))
+        return true;
+
+    // keep journaling until the next flush if the option was turned off meanwhile, the journal must stay the only writer
+    const CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    return characterState != nullptr && !characterState->journal.empty();
+}
+
+bool ItemUpgrade::JournalItemUpgrade(const Player* player, const Item* item)
+{
+    if (!IsWriteBehind(player))
+        return false;
+
+    ObjectGuid::LowType itemGuid = item->GetGUID().GetCounter();
+    CharacterUpgradeState& characterState = GetCharacterUpgradeState(player);
+    if (characterState.journal.find(itemGuid) != characterState.journal.end())
+        return true;
+
+    // first change since the last flush, what is in memory now is what is persisted
+    PersistedItemUpgrade& persisted = characterState.journal[itemGuid];
+    if (const ItemUpgradeState* state = FindItemUpgradeState(player, item))
     {
-        Field* fields = result->Fetch();
+        for (uint32 statType = 0; statType < MAX_ITEM_MOD; statType++)
+            if (state->stats[statType] != nullptr)
+                persisted.statIds[statType] = state->stats[statType]->statId;
+        persisted.weaponUpgradeModPct = state->weaponUpgradeModPct;
+    }
+
+    return true;
+}
+
+void ItemUpgrade::FlushUpgradeJournal(const Player* player)
+{
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    if (characterState == nullptr || characterState->journal.empty())
+        return;
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    FlushUpgradeJournal(*characterState, trans);
+    if (trans->GetSize() > 0)
+        CharacterDatabase.CommitTransaction(trans);
+}
+
+void ItemUpgrade::FlushUpgradeJournals()
+{
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    VisitCharacterUpgradeStates([&](CharacterUpgradeState& characterState) { FlushUpgradeJournal(characterState, trans); });
+
+    if (trans->GetSize() > 0)
+        CharacterDatabase.DirectCommitTransaction(trans);
+}
+
+void ItemUpgrade::FlushUpgradeJournal(CharacterUpgradeState& characterState, CharacterDatabaseTransaction trans)
+{
+    uint32 guid = characterState.guid;
+    for (const auto& journalPair : characterState.journal)
+    {
+        ObjectGuid::LowType itemGuid = journalPair.first;
+        const PersistedItemUpgrade& persisted = journalPair.second;
 
-        uint32 guidLow = fields[0].Get<uint32>();
-        ObjectGuid itemGuid = ObjectGuid::Create<HighGuid::Item>(fields[1].Get<uint32>());
-        float perc = fields[2].Get<float>();
+        const ItemUpgradeState* state = nullptr;
+        ItemUpgradeContainer::const_iterator citer = characterState.items.find(itemGuid);
+        if (citer != characterState.items.end())
+            state = &citer->second;
 
-        CharacterUpgrade characterUpgrade;
-        characterUpgrade.guid = guidLow;
-        characterUpgrade.itemGuid = itemGuid;
-        characterUpgrade.upgradeStat = FindWeaponUpgradeStat(perc);
-        if (characterUpgrade.upgradeStat == nullptr)
+        // only the difference between DB and memory is written, intermediate ranks never reach the DB
+        for (uint32 statType = 0; statType < MAX_ITEM_MOD; statType++)
         {
-            characterUpgrade.upgradeStat = FindNearestWeaponUpgradeStat(perc);
-            if (characterUpgrade.upgradeStat == nullptr) {
-                LOG_ERROR("sql.sql", "Table `character_weapon_upgrade` has invalid `upgrade_perc` {}, there is no other near percent that can be chosen, skip", perc);
+            uint32 persistedStatId = persisted.statIds[statType];
+            uint32 currentStatId = state != nullptr && state->stats[statType] != nullptr ? state->stats[statType]->statId : 0;
+            if (persistedStatId == currentStatId)
                 continue;
-            }
+
+            if (persistedStatId == 0)
+                ExecuteUpgradeWrite(trans, Acore::StringFormat("INSERT INTO character_item_upgrade (guid, item_guid, stat_id) VALUES ({}, {}, {})",
+                    guid, itemGuid, currentStatId));
+            else if (currentStatId == 0)
+                ExecuteUpgradeWrite(trans, Acore::StringFormat("DELETE FROM character_item_upgrade WHERE guid = {} AND item_guid = {} AND stat_id = {}",
+                    guid, itemGuid, persistedStatId));
             else
-                LOG_INFO("sql.sql", "Table `character_weapon_upgrade` has invalid `upgrade_perc` {} but a near percentage was chosen: {}", perc, characterUpgrade.upgradeStat->statModPct);
+                ExecuteUpgradeWrite(trans, Acore::StringFormat("UPDATE character_item_upgrade SET stat_id = {} WHERE guid = {} AND item_guid = {} AND stat_id = {}",
+                    currentStatId, guid, itemGuid, persistedStatId));
         }
-        characterUpgrade.upgradeStatModPct = perc;
-        characterWeaponUpgradeData[guidLow].push_back(characterUpgrade);
-        count++;
-    } while (result->NextRow());
 
-    LOG_INFO("server.loading", ">> Loaded {} character weapon item upgrades in {} ms", count, GetMSTimeDiffToNow(oldMSTime));
-    LOG_INFO("server.loading", " ");
+        float currentWeaponUpgradeModPct = state != nullptr ? state->weaponUpgradeModPct : 0.0f;
+        if (persisted.weaponUpgradeModPct != currentWeaponUpgradeModPct)
+        {
+            if (currentWeaponUpgradeModPct == 0.0f)
+                ExecuteUpgradeWrite(trans, Acore::StringFormat("DELETE FROM character_weapon_upgrade WHERE guid = {} AND item_guid = {}", guid, itemGuid));
+            else
+                ExecuteUpgradeWrite(trans, Acore::StringFormat("REPLACE INTO character_weapon_upgrade (guid, item_guid, upgrade_perc) VALUES ({}, {}, {})",
+                    guid, itemGuid, currentWeaponUpgradeModPct));
+        }
+    }
+
+    characterState.journal.clear();
+}
+
+CharacterDatabaseTransaction ItemUpgrade::BeginUpgradeTransaction(const Player* player, std::size_t writes) const
+{
+    // a single write does not need a transaction and journaled changes are not written at all
+    if (writes <= 1 || IsWriteBehind(player))
+        return nullptr;
+
+    return CharacterDatabase.BeginTransaction();
+}
+
+void ItemUpgrade::CommitUpgradeTransaction(CharacterDatabaseTransaction trans) const
+{
+    if (trans)
+        CharacterDatabase.CommitTransaction(trans);
+}
+
+void ItemUpgrade::RemapItemUpgradeState(ItemUpgradeState& state)
+{
+    // upgrades are matched by statId, the state may still point into the previous snapshot
+    state.InvalidateItemLevel();
+    if (state.statCount == 0)
+        return;
+
+    std::array<const UpgradeStat*, MAX_ITEM_MOD> oldStats = state.stats;
+    state.stats.fill(nullptr);
+    state.statCount = 0;
+    for (const UpgradeStat* oldStat : oldStats)
+        if (oldStat != nullptr)
+            if (const UpgradeStat* newStat = FindUpgradeStat(oldStat->statId))
+                SetItemUpgradeStat(state, newStat);
 }
 
 bool ItemUpgrade::IsValidReqType(uint8 reqType) const
@@ -477,36 +997,34 @@ bool ItemUpgrade::IsValidReqType(uint8 reqType) const
     return reqType >= REQ_TYPE_COPPER && reqType < MAX_REQ_TYPE;
 }
 
-bool ItemUpgrade::ValidateReq(uint32 id, UpgradeStatReqType reqType, float val1, float val2, const std::string& table) const
+bool ItemUpgrade::ValidateReq(uint32 id, UpgradeStatReqType reqType, int64 val1, int64 val2, const std::string& table, const RequirementLimits& limits) const
 {
-    int32 val1Int = static_cast<int32>(val1);
     switch (reqType)
     {
         case ItemUpgrade::REQ_TYPE_COPPER:
-            if (val1Int >= 1 && val1Int <= MAX_MONEY_AMOUNT)
+            if (val1 >= 1 && uint64(val1) <= limits.copper)
                 return true;
             LOG_ERROR("sql.sql", "Table `{}` has invalid `req_val1` {} (copper amount) for `id` {}, skip", table, val1, id);
             return false;
         case ItemUpgrade::REQ_TYPE_HONOR:
-            if (val1Int >= 1 && val1Int <= sWorld->getIntConfig(CONFIG_MAX_HONOR_POINTS))
+            if (val1 >= 1 && val1 <= limits.honor)
                 return true;
             LOG_ERROR("sql.sql", "Table `{}` has invalid `req_val1` {} (honor points) for `id` {}, skip", table, val1, id);
             return false;
         case ItemUpgrade::REQ_TYPE_ARENA:
-            if (val1Int >= 1 && val1Int <= sWorld->getIntConfig(CONFIG_MAX_ARENA_POINTS))
+            if (val1 >= 1 && val1 <= limits.arena)
                 return true;
             LOG_ERROR("sql.sql", "Table `{}` has invalid `req_val1` {} (arena points) for `id` {}, skip", table, val1, id);
             return false;
         case ItemUpgrade::REQ_TYPE_ITEM:
         {
-            const ItemTemplate* itemTemplate = sObjectMgr->GetItemTemplate(val1Int);
+            const ItemTemplate* itemTemplate = val1 >= 1 && val1 <= std::numeric_limits<uint32>::max() ? sObjectMgr->GetItemTemplate(uint32(val1)) : nullptr;
             if (!itemTemplate)
             {
                 LOG_ERROR("sql.sql", "Table `{}` has invalid `req_val1` {} (item entry not found) for `id` {}, skip", table, val1, id);
                 return false;
             }
-            int32 val2Int = static_cast<int32>(val2);
-            if (val2Int >= 1)
+            if (val2 >= 1 && val2 <= std::numeric_limits<uint32>::max())
                 return true;
             LOG_ERROR("sql.sql", "Table `{}` has invalid `req_val2` {} (item count invalid) for `id` {}, skip", table, val2, id);
             return false;
@@ -517,6 +1035,23 @@ bool ItemUpgrade::ValidateReq(uint32 id, UpgradeStatReqType reqType, float val1,
     return false;
 }
 
+/*static*/ ItemUpgrade::UpgradeStatReq ItemUpgrade::MakeStatReq(uint32 statId, UpgradeStatReqType reqType, int64 val1, int64 val2)
+{
+    // values were checked by ValidateReq
+    switch (reqType)
+    {
+        case REQ_TYPE_COPPER:
+            return UpgradeStatReq::Copper(statId, uint64(val1));
+        case REQ_TYPE_HONOR:
+        case REQ_TYPE_ARENA:
+            return UpgradeStatReq::Points(statId, reqType, uint32(val1));
+        case REQ_TYPE_ITEM:
+            return UpgradeStatReq::Items(statId, uint32(val1), uint32(val2));
+        default:
+            return UpgradeStatReq(statId, reqType);
+    }
+}
+
 /*static*/ std::string ItemUpgrade::ItemIcon(const ItemTemplate* proto, uint32 width, uint32 height, int x, int y)
 {
     std::ostringstream ss;
@@ -656,14 +1191,12 @@ void ItemUpgrade::BuildUpgradableItemCatalogue(const Player* player, PagedDataTy
     pagedData.upgradeStat = nullptr;
     pagedData.type = type;
 
-    std::vector<Item*> playerItems = GetPlayerItems(player, false);
-    std::vector<Item*>::iterator iter = playerItems.begin();
-    for (iter; iter != playerItems.end(); ++iter)
+    VisitPlayerItems(player, INVENTORY_SCOPE_INVENTORY, [&](Item* item, InventoryScope /*scope*/)
     {
-        bool valid = type == PAGED_DATA_TYPE_WEAPON_UPGRADE_ITEMS ? IsValidWeaponForUpgrade(*iter, player) : IsValidItemForUpgrade(*iter, player);
+        bool valid = type == PAGED_DATA_TYPE_WEAPON_UPGRADE_ITEMS ? IsValidWeaponForUpgrade(item, player) : IsValidItemForUpgrade(item, player);
         if (valid)
-            AddItemToPagedData(*iter, player, pagedData);
-    }
+            AddItemToPagedData(item, player, pagedData);
+    });
 
     pagedData.SortAndCalculateTotals();
 }
@@ -676,11 +1209,12 @@ bool ItemUpgrade::IsValidItemForUpgrade(const Item* item, const Player* player)
     if (item->GetOwnerGUID() != player->GetGUID())
         return false;
 
-    if (LoadItemStatInfo(item).empty())
+    uint8 flags = GetDefinitions().GetItemTemplateFlags(item->GetTemplate());
+    if (flags & ITEM_TEMPLATE_FLAG_HEIRLOOM)
         return false;
 
-    const ItemTemplate* proto = item->GetTemplate();
-    if (proto->Quality == ITEM_QUALITY_HEIRLOOM)
+    // only random suffixes and enchants have to be looked at per item
+    if (!(flags & ITEM_TEMPLATE_FLAG_HAS_STATS) && !HasEnchantmentStats(item))
         return false;
 
     if (item->IsBroken())
@@ -697,18 +1231,14 @@ bool ItemUpgrade::IsValidWeaponForUpgrade(const Item* item, const Player* player
     if (item->GetOwnerGUID() != player->GetGUID())
         return false;
 
-    const ItemTemplate* proto = item->GetTemplate();
-    if (proto->Quality == ITEM_QUALITY_HEIRLOOM)
+    uint8 flags = GetDefinitions().GetItemTemplateFlags(item->GetTemplate());
+    if (flags & ITEM_TEMPLATE_FLAG_HEIRLOOM)
         return false;
 
     if (item->IsBroken())
         return false;
 
-    std::pair<float, float> dmg = GetItemProtoDamage(proto);
-    if (dmg.first > 0 && dmg.second > 0)
-        return true;
-
-    return false;
+    return (flags & ITEM_TEMPLATE_FLAG_HAS_WEAPON_DAMAGE) != 0;
 }
 
 void ItemUpgrade::AddItemToPagedData(const Item* item, const Player* player, PagedData& pagedData)
@@ -726,12 +1256,7 @@ void ItemUpgrade::AddItemToPagedData(const Item* item, const Player* player, Pag
 
 ItemUpgrade::PagedData& ItemUpgrade::GetPagedData(const Player* player)
 {
-    return playerPagedData[player->GetGUID().GetCounter()];
-}
-
-ItemUpgrade::PagedDataMap& ItemUpgrade::GetPagedDataMap()
-{
-    return playerPagedData;
+    return GetCharacterUpgradeState(player).pagedData;
 }
 
 bool ItemUpgrade::_AddPagedData(Player* player, const PagedData& pagedData, uint32 page) const
@@ -765,7 +1290,7 @@ bool ItemUpgrade::_AddPagedData(Player* player, const PagedData& pagedData, uint
 
         if (pagedData.type == PAGED_DATA_TYPE_STATS)
         {
-            std::vector<_ItemStat> statTypes = LoadItemStatInfo(item);
+            ItemStatInfo statTypes = LoadItemStatInfo(item);
             std::ostringstream ossStatTypes;
             ossStatTypes << "HAS STATS: ";
             for (uint32 i = 0; i < statTypes.size(); i++)
@@ -782,7 +1307,7 @@ bool ItemUpgrade::_AddPagedData(Player* player, const PagedData& pagedData, uint
         else if (pagedData.type == PAGED_DATA_TYPE_REQS)
         {
             const UpgradeStat* upgradeStat = pagedData.upgradeStat;
-            std::vector<_ItemStat> statInfoList = LoadItemStatInfo(item);
+            ItemStatInfo statInfoList = LoadItemStatInfo(item);
             const _ItemStat* statInfo = GetStatByType(statInfoList, upgradeStat->statType);
             if (!statInfo)
                 return false;
@@ -802,7 +1327,7 @@ bool ItemUpgrade::_AddPagedData(Player* player, const PagedData& pagedData, uint
             ilvloss << "[ITEM LEVEL ";
             ilvloss << "|cffb50505" << itemLevel.first << "|r --> ";
             ilvloss << "|cff056e3a" << itemLevel.second << "|r]";
-            itemLevel = CalculateItemLevel(player, item);
+            itemLevel = GetItemLevel(player, item);
             ilvloss << " [CURRENT: " << itemLevel.second << "]";
             
             AddGossipItemFor(player, GOSSIP_ICON_CHAT, oss.str(), GOSSIP_SENDER_MAIN + 2, GOSSIP_ACTION_INFO_DEF + page);
@@ -810,7 +1335,7 @@ bool ItemUpgrade::_AddPagedData(Player* player, const PagedData& pagedData, uint
         }
         else if (pagedData.type == PAGED_DATA_TYPE_UPGRADED_ITEMS_STATS)
         {
-            std::pair<uint32, uint32> itemLevel = CalculateItemLevel(player, item);
+            std::pair<uint32, uint32> itemLevel = GetItemLevel(player, item);
             uint32 diff = itemLevel.second - itemLevel.first;
 
             std::ostringstream oss;
@@ -840,7 +1365,7 @@ bool ItemUpgrade::_AddPagedData(Player* player, const PagedData& pagedData, uint
             else
             {
                 std::pair<uint32, uint32> ilvl = CalculateItemLevel(player, item, upgrades);
-                std::pair<uint32, uint32> currentIlvl = CalculateItemLevel(player, item);
+                std::pair<uint32, uint32> currentIlvl = GetItemLevel(player, item);
                 oss << "[ITEM LEVEL |cffb50505" << ilvl.first << "|r --> " << "|cff056e3a" << ilvl.second << "|r]";
                 oss << " [CURRENT: " << currentIlvl.second << "]";
             }
@@ -1316,49 +1841,37 @@ Item* ItemUpgrade::FindItemIdentifierFromPage(const PagedData& pagedData, uint32
     return nullptr;
 }
 
-bool ItemUpgrade::HandlePurchaseRank(Player* player, Item* item, const UpgradeStat* upgrade)
+bool ItemUpgrade::HandlePurchaseRank(Player* player, Item* item, const UpgradeStat* upgrade, CharacterDatabaseTransaction trans)
 {
+    if (upgrade->statType >= MAX_ITEM_MOD)
+        return false;
+
     const UpgradeStat* foundUpgrade = FindUpgradeForItem(player, item, upgrade->statType);
-    std::vector<CharacterUpgrade>& upgrades = characterUpgradeData[player->GetGUID().GetCounter()];
-    if (foundUpgrade != nullptr)
+    if (!JournalItemUpgrade(player, item))
     {
-        std::vector<CharacterUpgrade>::const_iterator citer = std::remove_if(upgrades.begin(), upgrades.end(),
-            [&](const CharacterUpgrade& upgrade) { return upgrade.itemGuid == item->GetGUID() && upgrade.upgradeStat->statId == foundUpgrade->statId; });
-        if (citer == upgrades.end())
-            return false;
-        upgrades.erase(citer, upgrades.end());
-
-        CharacterDatabase.Execute("UPDATE character_item_upgrade SET stat_id = {} WHERE guid = {} AND item_guid = {} AND stat_id = {}",
-            upgrade->statId, player->GetGUID().GetCounter(), item->GetGUID().GetCounter(), foundUpgrade->statId);
+        if (foundUpgrade != nullptr)
+            ExecuteUpgradeWrite(trans, Acore::StringFormat("UPDATE character_item_upgrade SET stat_id = {} WHERE guid = {} AND item_guid = {} AND stat_id = {}",
+                upgrade->statId, player->GetGUID().GetCounter(), item->GetGUID().GetCounter(), foundUpgrade->statId));
+        else
+            AddItemUpgradeToDB(player, item, upgrade, trans);
     }
-    else
-        AddItemUpgradeToDB(player, item, upgrade);
 
-    CharacterUpgrade newUpgrade;
-    newUpgrade.guid = player->GetGUID().GetCounter();
-    newUpgrade.itemGuid = item->GetGUID();
-    newUpgrade.upgradeStat = upgrade;
-    upgrades.push_back(newUpgrade);
+    SetItemUpgradeStat(GetOrCreateItemUpgradeState(player, item), upgrade);
+    CountMetric(METRIC_COUNTER_PURCHASES);
 
     return true;
 }
 
 bool ItemUpgrade::HandlePurchaseWeaponUpgrade(Player* player, Item* item, const UpgradeStat* upgrade)
 {
-    std::vector<CharacterUpgrade>& upgrades = characterWeaponUpgradeData[player->GetGUID().GetCounter()];
-    std::vector<CharacterUpgrade>::const_iterator citer = std::remove_if(upgrades.begin(), upgrades.end(),
-        [&](const CharacterUpgrade& upgrade) { return upgrade.itemGuid == item->GetGUID(); });
-    upgrades.erase(citer, upgrades.end());
-
-    CharacterDatabase.Execute("REPLACE INTO character_weapon_upgrade (guid, item_guid, upgrade_perc) VALUES ({}, {}, {})",
-        player->GetGUID().GetCounter(), item->GetGUID().GetCounter(), upgrade->statModPct);
+    if (!JournalItemUpgrade(player, item))
+        ExecuteUpgradeWrite(nullptr, Acore::StringFormat("REPLACE INTO character_weapon_upgrade (guid, item_guid, upgrade_perc) VALUES ({}, {}, {})",
+            player->GetGUID().GetCounter(), item->GetGUID().GetCounter(), upgrade->statModPct));
 
-    CharacterUpgrade newUpgrade;
-    newUpgrade.guid = player->GetGUID().GetCounter();
-    newUpgrade.itemGuid = item->GetGUID();
-    newUpgrade.upgradeStat = upgrade;
-    newUpgrade.upgradeStatModPct = upgrade->statModPct;
-    upgrades.push_back(newUpgrade);
+    ItemUpgradeState& state = GetOrCreateItemUpgradeState(player, item);
+    state.weaponUpgrade = upgrade;
+    state.weaponUpgradeModPct = upgrade->statModPct;
+    CountMetric(METRIC_COUNTER_PURCHASES);
 
     return true;
 }
@@ -1382,7 +1895,7 @@ bool ItemUpgrade::PurchaseUpgrade(Player* player)
     if (item->IsEquipped())
         player->_ApplyItemMods(item, item->GetSlot(), false);
 
-    HandlePurchaseRank(player, item, pagedData.upgradeStat);
+    HandlePurchaseRank(player, item, pagedData.upgradeStat, nullptr);
 
     if (item->IsEquipped())
         player->_ApplyItemMods(item, item->GetSlot(), true);
@@ -1452,8 +1965,11 @@ bool ItemUpgrade::PurchaseUpgradeBulk(Player* player)
     if (item->IsEquipped())
         player->_ApplyItemMods(item, item->GetSlot(), false);
 
+    // all ranks are written at once, a crash can not leave the item half upgraded
+    CharacterDatabaseTransaction trans = BeginUpgradeTransaction(player, upgrades.size());
     for (const auto& upair : upgrades)
-        HandlePurchaseRank(player, item, upair.second);
+        HandlePurchaseRank(player, item, upair.second, trans);
+    CommitUpgradeTransaction(trans);
 
     if (item->IsEquipped())
         player->_ApplyItemMods(item, item->GetSlot(), true);
@@ -1470,6 +1986,8 @@ bool ItemUpgrade::PurchaseUpgradeBulk(Player* player)
 
 int32 ItemUpgrade::HandleStatModifier(const Player* player, uint8 slot, uint32 statType, int32 amount) const
 {
+    ItemUpgradeProfileScope profile(PROFILE_STAT_MODIFIER_SLOT);
+
     if (amount == 0)
         return 0;
 
@@ -1477,19 +1995,46 @@ int32 ItemUpgrade::HandleStatModifier(const Player* player, uint8 slot, uint32 s
     if (!item)
         return amount;
 
-    return HandleStatModifier(player, item, statType, amount, MAX_ENCHANTMENT_SLOT);
+    return _HandleStatModifier(player, item, statType, amount, MAX_ENCHANTMENT_SLOT);
 }
 
 int32 ItemUpgrade::HandleStatModifier(const Player* player, Item* item, uint32 statType, int32 amount, EnchantmentSlot slot) const
 {
-    if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_ENABLED) || !IsAllowedItem(item) || IsBlacklistedItem(item) || !IsAllowedStatType(statType))
-        return amount;
+    ItemUpgradeProfileScope profile(PROFILE_STAT_MODIFIER_ITEM);
+    return _HandleStatModifier(player, item, statType, amount, slot);
+}
 
+int32 ItemUpgrade::_HandleStatModifier(const Player* player, Item* item, uint32 statType, int32 amount, EnchantmentSlot slot) const
+{
     if (slot < MAX_INSPECTED_ENCHANTMENT_SLOT)
         return amount;
 
-    const UpgradeStat* foundUpgrade = FindUpgradeForItem(player, item, statType);
-    if (foundUpgrade != nullptr && CanApplyUpgradeForItem(item, foundUpgrade))
+    // one registry lookup for the player, then one probe of its item map
+    const CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    return ModifyStat(item->GetEntry(), FindItemUpgradeState(characterState, item), FindPendingModifierSources(characterState), statType, amount);
+}
+
+int32 ItemUpgrade::ModifyStat(uint32 entry, const ItemUpgradeState* state, const ModifierSources* pendingSources, uint32 statType, int32 amount) const
+{
+    // not migrated yet after a reload, keep the modifiers the player had applied
+    if (pendingSources != nullptr)
+    {
+        if (state == nullptr || statType >= MAX_ITEM_MOD)
+            return amount;
+
+        const UpgradeStat* pendingUpgrade = GetItemModifiers(entry, *state, *pendingSources).stats[statType];
+        return pendingUpgrade != nullptr ? CalculateModPct(amount, pendingUpgrade) : amount;
+    }
+
+    const UpgradeDefinitions& itemDefinitions = GetDefinitions();
+    if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_ENABLED) || !itemDefinitions.IsAllowedItem(entry) || itemDefinitions.IsBlacklistedItem(entry) || !IsAllowedStatType(statType))
+        return amount;
+
+    if (state == nullptr || statType >= MAX_ITEM_MOD)
+        return amount;
+
+    const UpgradeStat* foundUpgrade = state->stats[statType];
+    if (foundUpgrade != nullptr && itemDefinitions.IsAllowedStatForItem(entry, foundUpgrade) && !itemDefinitions.IsBlacklistedStatForItem(entry, foundUpgrade))
         return CalculateModPct(amount, foundUpgrade);
 
     return amount;
@@ -1502,19 +2047,31 @@ std::pair<float, float> ItemUpgrade::HandleWeaponModifier(const Player* player,
 
 std::pair<float, float> ItemUpgrade::HandleWeaponModifier(const Player* player, const Item* item, float minDamage, float maxDamage) const
 {
-    if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_ENABLED))
-        return std::make_pair(minDamage, maxDamage);
-
-    if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE))
-        return std::make_pair(minDamage, maxDamage);
+    ItemUpgradeProfileScope profile(PROFILE_WEAPON_MODIFIER);
 
     if (!item)
         return std::make_pair(minDamage, maxDamage);
 
-    if (minDamage == 0.0f || maxDamage == 0.0f)
+    const CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    return ModifyWeaponDamage(item->GetEntry(), FindItemUpgradeState(characterState, item), FindPendingModifierSources(characterState), minDamage, maxDamage);
+}
+
+std::pair<float, float> ItemUpgrade::ModifyWeaponDamage(uint32 entry, const ItemUpgradeState* state, const ModifierSources* pendingSources, float minDamage, float maxDamage) const
+{
+    if (pendingSources == nullptr)
+    {
+        if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_ENABLED))
+            return std::make_pair(minDamage, maxDamage);
+
+        if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE))
+            return std::make_pair(minDamage, maxDamage);
+    }
+
+    if (minDamage == 0.0f || maxDamage == 0.0f || state == nullptr)
         return std::make_pair(minDamage, maxDamage);
 
-    const UpgradeStat* weaponUpgrade = FindUpgradeForWeapon(player, item);
+    // not migrated yet after a reload, keep the modifiers the player had applied
+    const UpgradeStat* weaponUpgrade = pendingSources != nullptr ? GetItemModifiers(entry, *state, *pendingSources).weaponUpgrade : state->weaponUpgrade;
     if (weaponUpgrade == nullptr)
         return std::make_pair(minDamage, maxDamage);
 
@@ -1525,43 +2082,61 @@ std::pair<float, float> ItemUpgrade::HandleWeaponModifier(const Player* player,
 
 void ItemUpgrade::HandleItemRemove(Player* player, Item* item)
 {
-    bool hasItemUpgrades = !FindUpgradesForItem(player, item).empty();
-    bool hasWeaponUpgrade = FindUpgradeForWeapon(player, item) != nullptr;
+    ItemUpgradeProfileScope profile(PROFILE_ITEM_REMOVE);
+
+    const ItemUpgradeState* state = FindItemUpgradeState(player, item);
+    if (state == nullptr)
+        return;
+
+    bool hasItemUpgrades = state->statCount > 0;
+    bool hasWeaponUpgrade = state->weaponUpgrade != nullptr;
     if (hasItemUpgrades || hasWeaponUpgrade)
     {
         player->_ApplyItemMods(item, item->GetSlot(), false);
+        CharacterDatabaseTransaction trans = BeginUpgradeTransaction(player, (hasItemUpgrades ? 1 : 0) + (hasWeaponUpgrade ? 1 : 0));
         if (hasItemUpgrades)
-            RemoveItemUpgrade(player, item);
+            RemoveItemUpgrade(player, item, trans);
         if (hasWeaponUpgrade)
-            RemoveWeaponUpgrade(player, item);
+            RemoveWeaponUpgrade(player, item, trans);
+        CommitUpgradeTransaction(trans);
         player->_ApplyItemMods(item, item->GetSlot(), true);
     }
 }
 
-void ItemUpgrade::RemoveItemUpgradeFromContainer(CharacterUpgradeContainer& upgradesContainer, Player* player, Item* item)
+void ItemUpgrade::RemoveItemUpgrade(Player* player, Item* item, CharacterDatabaseTransaction trans)
 {
-    std::vector<CharacterUpgrade>& upgrades = upgradesContainer[player->GetGUID().GetCounter()];
-    std::vector<CharacterUpgrade>::const_iterator citer = std::remove_if(upgrades.begin(), upgrades.end(),
-        [&](const CharacterUpgrade& upgrade) { return upgrade.itemGuid == item->GetGUID(); });
-    upgrades.erase(citer, upgrades.end());
-}
+    if (!JournalItemUpgrade(player, item))
+        ExecuteUpgradeWrite(trans, Acore::StringFormat("DELETE FROM character_item_upgrade WHERE guid = {} AND item_guid = {}",
+            player->GetGUID().GetCounter(), item->GetGUID().GetCounter()));
 
-void ItemUpgrade::RemoveItemUpgrade(Player* player, Item* item)
-{
-    RemoveItemUpgradeFromContainer(characterUpgradeData, player, item);
-    CharacterDatabase.Execute("DELETE FROM character_item_upgrade WHERE guid = {} AND item_guid = {}", player->GetGUID().GetCounter(), item->GetGUID().GetCounter());
+    if (ItemUpgradeState* state = FindItemUpgradeState(player, item))
+    {
+        state->stats.fill(nullptr);
+        state->statCount = 0;
+        state->InvalidateItemLevel();
+        EraseItemUpgradeStateIfEmpty(player, item);
+    }
 }
 
-void ItemUpgrade::RemoveWeaponUpgrade(Player* player, Item* item)
+void ItemUpgrade::RemoveWeaponUpgrade(Player* player, Item* item, CharacterDatabaseTransaction trans)
 {
-    RemoveItemUpgradeFromContainer(characterWeaponUpgradeData, player, item);
-    CharacterDatabase.Execute("DELETE FROM character_weapon_upgrade WHERE guid = {} AND item_guid = {}", player->GetGUID().GetCounter(), item->GetGUID().GetCounter());
+    if (!JournalItemUpgrade(player, item))
+        ExecuteUpgradeWrite(trans, Acore::StringFormat("DELETE FROM character_weapon_upgrade WHERE guid = {} AND item_guid = {}",
+            player->GetGUID().GetCounter(), item->GetGUID().GetCounter()));
+
+    if (ItemUpgradeState* state = FindItemUpgradeState(player, item))
+    {
+        state->weaponUpgrade = nullptr;
+        state->weaponUpgradeModPct = 0.0f;
+        EraseItemUpgradeStateIfEmpty(player, item);
+    }
 }
 
 void ItemUpgrade::HandleCharacterRemove(uint32 guid)
 {
-    characterUpgradeData[guid].clear();
-    characterWeaponUpgradeData[guid].clear();
+    // the state itself goes away with its Player, only what is kept by GUID is dropped here
+    if (modifierMigration)
+        modifierMigration->pendingPlayers.erase(guid);
 }
 
 void ItemUpgrade::BuildRequirementsPage(const Player* player, PagedData& pagedData, const StatRequirementContainer* reqs) const
@@ -1585,21 +2160,21 @@ void ItemUpgrade::BuildRequirementsPage(const Player* player, PagedData& pagedDa
             switch (req.reqType)
             {
                 case REQ_TYPE_COPPER:
-                    oss << "MONEY: " << CopperToMoneyStr((uint32)req.reqVal1, true);
+                    oss << "MONEY: " << CopperToMoneyStr(req.copper, true);
                     break;
                 case REQ_TYPE_HONOR:
-                    oss << "HONOR: " << (uint32)req.reqVal1 << " points";
+                    oss << "HONOR: " << req.points << " points";
                     break;
                 case REQ_TYPE_ARENA:
-                    oss << "ARENA: " << (uint32)req.reqVal1 << " points";
+                    oss << "ARENA: " << req.points << " points";
                     break;
                 case REQ_TYPE_ITEM:
                 {
-                    const ItemTemplate* proto = sObjectMgr->GetItemTemplate((uint32)req.reqVal1);
+                    const ItemTemplate* proto = sObjectMgr->GetItemTemplate(req.itemEntry);
                     oss << ItemIcon(proto);
                     oss << ItemLink(player, proto, 0);
-                    if (req.reqVal2 > 1.0f)
-                        oss << " - " << (uint32)req.reqVal2 << "x";
+                    if (req.itemCount > 1)
+                        oss << " - " << req.itemCount << "x";
                     break;
                 }
             }
@@ -1610,16 +2185,16 @@ void ItemUpgrade::BuildRequirementsPage(const Player* player, PagedData& pagedDa
                 switch (req.reqType)
                 {
                     case REQ_TYPE_COPPER:
-                        missing = "missing " + CopperToMoneyStr((uint32)req.reqVal1 - player->GetMoney(), true);
+                        missing = "missing " + CopperToMoneyStr(req.copper - player->GetMoney(), true);
                         break;
                     case REQ_TYPE_HONOR:
-                        missing = "missing " + Acore::ToString<uint32>((uint32)req.reqVal1 - player->GetHonorPoints()) + " points";
+                        missing = "missing " + Acore::ToString<uint32>(req.points - player->GetHonorPoints()) + " points";
                         break;
                     case REQ_TYPE_ARENA:
-                        missing = "missing " + Acore::ToString<uint32>((uint32)req.reqVal1 - player->GetArenaPoints()) + " points";
+                        missing = "missing " + Acore::ToString<uint32>(req.points - player->GetArenaPoints()) + " points";
                         break;
                     case REQ_TYPE_ITEM:
-                        missing = "missing " + Acore::ToString<uint32>((uint32)req.reqVal2 - player->GetItemCount((uint32)req.reqVal1, true)) + " items";
+                        missing = "missing " + Acore::ToString<uint32>(req.itemCount - player->GetItemCount(req.itemEntry, true)) + " items";
                         break;
                 }
             }
@@ -1659,40 +2234,24 @@ void ItemUpgrade::BuildAlreadyUpgradedItemsCatalogue(const Player* player, Paged
     pagedData.item.guid = ObjectGuid::Empty;
     pagedData.type = type;
 
-    for (uint8 i = INVENTORY_SLOT_ITEM_START; i < INVENTORY_SLOT_ITEM_END; i++)
-        if (Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, i))
-            AddUpgradedItemToPagedData(item, player, pagedData, "backpack");
-
-    for (uint8 i = INVENTORY_SLOT_BAG_START; i < INVENTORY_SLOT_BAG_END; i++)
-        if (Bag* bag = player->GetBagByPos(i))
-            for (uint32 j = 0; j < bag->GetBagSize(); j++)
-                if (Item* item = player->GetItemByPos(i, j))
-                    AddUpgradedItemToPagedData(item, player, pagedData, "bags");
-
-    for (uint8 i = EQUIPMENT_SLOT_START; i < EQUIPMENT_SLOT_END; i++)
-        if (Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, i))
-            AddUpgradedItemToPagedData(item, player, pagedData, "equipped");
-
-    for (uint8 i = BANK_SLOT_ITEM_START; i < BANK_SLOT_ITEM_END; i++)
-        if (Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, i))
-            AddUpgradedItemToPagedData(item, player, pagedData, "bank");
-
-    for (uint8 i = BANK_SLOT_BAG_START; i < BANK_SLOT_BAG_END; i++)
-        if (Bag* bag = player->GetBagByPos(i))
-            for (uint32 j = 0; j < bag->GetBagSize(); j++)
-                if (Item* item = player->GetItemByPos(i, j))
-                    AddUpgradedItemToPagedData(item, player, pagedData, "bank bags");
+    VisitUpgradedItems(player, INVENTORY_SCOPE_ALL, [&](Item* item, InventoryScope scope)
+    {
+        AddUpgradedItemToPagedData(item, player, pagedData, scope);
+    });
 
     pagedData.SortAndCalculateTotals();
 }
 
-void ItemUpgrade::AddUpgradedItemToPagedData(const Item* item, const Player* player, PagedData& pagedData, const std::string& from)
+void ItemUpgrade::AddUpgradedItemToPagedData(const Item* item, const Player* player, PagedData& pagedData, InventoryScope scope)
 {
     bool shouldAdd = false;
     if (pagedData.type == PAGED_DATA_TYPE_WEAPON_UPGRADE_ITEMS_CHECK)
         shouldAdd = FindUpgradeForWeapon(player, item) != nullptr;
     else
-        shouldAdd = !FindUpgradesForItem(player, item).empty();
+    {
+        const ItemUpgradeState* state = FindItemUpgradeState(player, item);
+        shouldAdd = state != nullptr && state->statCount > 0;
+    }
 
     if (shouldAdd)
     {
@@ -1702,7 +2261,7 @@ void ItemUpgrade::AddUpgradedItemToPagedData(const Item* item, const Player* pla
         itemIdentifier->id = pagedData.data.size();
         itemIdentifier->guid = item->GetGUID();
         itemIdentifier->name = ItemNameWithLocale(player, proto, item->GetItemRandomPropertyId());
-        itemIdentifier->uiName = ItemLinkForUI(item, player) + " [" + from + "]";
+        itemIdentifier->uiName = ItemLinkForUI(item, player) + " [" + InventoryScopeToString(scope) + "]";
 
         if (pagedData.type != PAGED_DATA_TYPE_WEAPON_UPGRADE_ITEMS_CHECK)
         {
@@ -1725,7 +2284,7 @@ void ItemUpgrade::BuildItemUpgradeStatsCatalogue(const Player* player, const Ite
     std::vector<const UpgradeStat*> itemUpgrades = FindUpgradesForItem(player, item);
     if (!itemUpgrades.empty())
     {
-        std::vector<_ItemStat> statInfo = LoadItemStatInfo(item);
+        ItemStatInfo statInfo = LoadItemStatInfo(item);
         for (const UpgradeStat* upgradeStat : itemUpgrades)
         {
             const _ItemStat* foundStat = GetStatByType(statInfo, upgradeStat->statType);
@@ -1910,13 +2469,13 @@ bool ItemUpgrade::MeetsRequirement(const Player* player, const UpgradeStatReq& r
     switch (req.reqType)
     {
         case REQ_TYPE_COPPER:
-            return player->HasEnoughMoney((int32)req.reqVal1);
+            return player->GetMoney() >= req.copper;
         case REQ_TYPE_HONOR:
-            return player->GetHonorPoints() >= (uint32)req.reqVal1;
+            return player->GetHonorPoints() >= req.points;
         case REQ_TYPE_ARENA:
-            return player->GetArenaPoints() >= (uint32)req.reqVal1;
+            return player->GetArenaPoints() >= req.points;
         case REQ_TYPE_ITEM:
-            return player->HasItemCount((uint32)req.reqVal1, (uint32)req.reqVal2, true);
+            return player->HasItemCount(req.itemEntry, req.itemCount, true);
         case REQ_TYPE_NONE:
             return true;
     }
@@ -1956,16 +2515,17 @@ void ItemUpgrade::TakeRequirements(Player* player, const StatRequirementContaine
         switch (req.reqType)
         {
             case REQ_TYPE_COPPER:
-                player->ModifyMoney(-(int32)req.reqVal1);
+                // never above the player's money, checked by MeetsRequirement
+                player->ModifyMoney(-int32(req.copper));
                 break;
             case REQ_TYPE_HONOR:
-                player->ModifyHonorPoints(-(int32)req.reqVal1);
+                player->ModifyHonorPoints(-int32(req.points));
                 break;
             case REQ_TYPE_ARENA:
-                player->ModifyArenaPoints(-(int32)req.reqVal1);
+                player->ModifyArenaPoints(-int32(req.points));
                 break;
             case REQ_TYPE_ITEM:
-                player->DestroyItemCount((uint32)req.reqVal1, (uint32)req.reqVal2, true);
+                player->DestroyItemCount(req.itemEntry, req.itemCount, true);
                 break;
         }
     }
@@ -1986,23 +2546,20 @@ void ItemUpgrade::BuildStatsUpgradeCatalogue(const Player* player, const Item* i
 
     if (IsAllowedItem(item) && !IsBlacklistedItem(item))
     {
-        std::vector<_ItemStat> statInfoList = LoadItemStatInfo(item);
-        std::unordered_map<uint32, bool> processed;
-        for (const UpgradeStat& stat : upgradeStatList)
+        ItemStatInfo statInfoList = LoadItemStatInfo(item);
+        for (uint32 statType = 0; statType < MAX_ITEM_MOD; statType++)
         {
-            if (processed.find(stat.statType) != processed.end())
+            if (GetDefinitions().upgradeStatsByType[statType].empty())
                 continue;
 
-            if (!IsAllowedStatType(stat.statType))
+            if (!IsAllowedStatType(statType))
                 continue;
 
-            const _ItemStat* statInfo = GetStatByType(statInfoList, stat.statType);
+            const _ItemStat* statInfo = GetStatByType(statInfoList, statType);
             if (!statInfo)
                 continue;
 
-            processed[stat.statType] = true;
-
-            const UpgradeStat* foundUpgrade = FindUpgradeForItem(player, item, stat.statType);
+            const UpgradeStat* foundUpgrade = FindUpgradeForItem(player, item, statType);
             const UpgradeStat* currentUpgrade = nullptr;
             bool atMaxRank = false;
             Identifier* identifier = new Identifier();
@@ -2012,7 +2569,7 @@ void ItemUpgrade::BuildStatsUpgradeCatalogue(const Player* player, const Item* i
             {
                 currentUpgrade = foundUpgrade;
 
-                const UpgradeStat* nextUpgrade = FindUpgradeStat(stat.statType, foundUpgrade->statRank + 1);
+                const UpgradeStat* nextUpgrade = FindUpgradeStat(statType, foundUpgrade->statRank + 1);
                 if (nextUpgrade == nullptr)
                 {
                     oss << "[RANK " << foundUpgrade->statRank << " |cffb50505MAX|r]";
@@ -2028,7 +2585,7 @@ void ItemUpgrade::BuildStatsUpgradeCatalogue(const Player* player, const Item* i
             }
             else
             {
-                foundUpgrade = FindUpgradeStat(stat.statType, 1);
+                foundUpgrade = FindUpgradeStat(statType, 1);
                 if (foundUpgrade == nullptr)
                     continue;
 
@@ -2052,19 +2609,86 @@ void ItemUpgrade::BuildStatsUpgradeCatalogue(const Player* player, const Item* i
                 oss << " [|cffb50505UPGRADE FORBIDDEN|r]";
 
             identifier->uiName = oss.str();
-            identifier->name = StatTypeToString(stat.statType);
+            identifier->name = StatTypeToString(statType);
             pagedData.data.push_back(identifier);
         }
     }
 
-    pagedData.SortAndCalculateTotals();
+    pagedData.SortAndCalculateTotals();
+}
+
+void ItemUpgrade::CreateUpgradesPctMap(UpgradeDefinitions& newDefinitions) const
+{
+    for (const UpgradeStat& ustat : newDefinitions.upgradeStatList)
+        newDefinitions.upgradesPctMap[ustat.statModPct].push_back(&ustat);
+}
+
+/*static*/ uint8 ItemUpgrade::ComputeItemTemplateFlags(const ItemTemplate* proto, const UpgradeDefinitions& itemDefinitions)
+{
+    uint8 flags = 0;
+    for (uint8 i = 0; i < MAX_ITEM_PROTO_STATS && i < proto->StatsCount; ++i)
+    {
+        if (proto->ItemStat[i].ItemStatValue > 0)
+        {
+            flags |= ITEM_TEMPLATE_FLAG_HAS_STATS;
+            break;
+        }
+    }
+
+    if (proto->Quality == ITEM_QUALITY_HEIRLOOM)
+        flags |= ITEM_TEMPLATE_FLAG_HEIRLOOM;
+
+    std::pair<float, float> dmg = GetItemProtoDamage(proto);
+    if (dmg.first > 0 && dmg.second > 0)
+        flags |= ITEM_TEMPLATE_FLAG_HAS_WEAPON_DAMAGE;
+
+    if (itemDefinitions.allowedItems.empty() || itemDefinitions.allowedItems.find(proto->ItemId) != itemDefinitions.allowedItems.end())
+        flags |= ITEM_TEMPLATE_FLAG_ALLOWED;
+
+    if (itemDefinitions.blacklistedItems.find(proto->ItemId) != itemDefinitions.blacklistedItems.end())
+        flags |= ITEM_TEMPLATE_FLAG_BLACKLISTED;
+
+    return flags;
+}
+
+void ItemUpgrade::BuildItemTemplateFlags(UpgradeDefinitions& newDefinitions) const
+{
+    const std::vector<ItemTemplate*>* itemTemplates = sObjectMgr->GetItemTemplateStoreFast();
+
+    newDefinitions.itemTemplateFlags.assign(itemTemplates->size(), 0);
+    for (const ItemTemplate* proto : *itemTemplates)
+        if (proto != nullptr)
+            newDefinitions.itemTemplateFlags[proto->ItemId] = ComputeItemTemplateFlags(proto, newDefinitions);
+}
+
+uint8 ItemUpgrade::UpgradeDefinitions::GetItemTemplateFlags(const ItemTemplate* proto) const
+{
+    if (proto->ItemId < itemTemplateFlags.size())
+        return itemTemplateFlags[proto->ItemId];
+
+    // not known when the table was built
+    return ComputeItemTemplateFlags(proto, *this);
 }
 
-void ItemUpgrade::CreateUpgradesPctMap()
+/*static*/ bool ItemUpgrade::HasEnchantmentStats(const Item* item)
 {
-    upgradesPctMap.clear();
-    for (const UpgradeStat& ustat : upgradeStatList)
-        upgradesPctMap[ustat.statModPct].push_back(&ustat);
+    // same enchantments LoadItemStatInfo turns into stats
+    for (uint32 slot = PROP_ENCHANTMENT_SLOT_0; slot < MAX_ENCHANTMENT_SLOT; ++slot)
+    {
+        uint32 enchant_id = item->GetEnchantmentId(EnchantmentSlot(slot));
+        if (!enchant_id)
+            continue;
+
+        SpellItemEnchantmentEntry const* pEnchant = sSpellItemEnchantmentStore.LookupEntry(enchant_id);
+        if (!pEnchant)
+            continue;
+
+        for (int s = 0; s < MAX_SPELL_ITEM_ENCHANTMENT_EFFECTS; ++s)
+            if (pEnchant->type[s] == ITEM_ENCHANTMENT_TYPE_STAT)
+                return true;
+    }
+
+    return false;
 }
 
 void ItemUpgrade::BuildStatsUpgradeCatalogueBulk(const Player* player, const Item* item)
@@ -2077,7 +2701,7 @@ void ItemUpgrade::BuildStatsUpgradeCatalogueBulk(const Player* player, const Ite
 
     if (IsAllowedItem(item) && !IsBlacklistedItem(item))
     {
-        for (const auto& upair : upgradesPctMap)
+        for (const auto& upair : GetDefinitions().upgradesPctMap)
         {
             FloatIdentifier* identifier = new FloatIdentifier();
             identifier->id = pagedData.data.size();
@@ -2100,10 +2724,11 @@ void ItemUpgrade::BuildStatsUpgradeByPctCatalogueBulk(const Player* player, cons
     pagedData.type = PAGED_DATA_TYPE_STAT_UPGRADE_BULK;
     pagedData.pct = pct;
 
+    const auto& upgradesPctMap = GetDefinitions().upgradesPctMap;
     if (upgradesPctMap.find(pct) != upgradesPctMap.end())
     {
         const std::vector<const UpgradeStat*>& upgrades = upgradesPctMap.at(pct);
-        std::vector<_ItemStat> statInfoList = LoadItemStatInfo(item);
+        ItemStatInfo statInfoList = LoadItemStatInfo(item);
         for (const UpgradeStat* stat : upgrades)
         {
             const _ItemStat* foundStat = GetStatByType(statInfoList, stat->statType);
@@ -2182,128 +2807,87 @@ void ItemUpgrade::BuildStatsRequirementsCatalogueBulk(const Player* player, cons
 
 ItemUpgrade::StatRequirementContainer ItemUpgrade::BuildBulkRequirements(const std::unordered_map<uint32, const UpgradeStat*>& upgrades, const Item* item) const
 {
-    StatRequirementContainer reqs;
-    if (upgrades.empty())
-        return reqs;
-
-    uint64 copper = 0;
-    uint32 arena = 0;
-    uint32 honor = 0;
-    std::unordered_map<uint32, uint32> itemMap;
+    std::vector<const StatRequirementContainer*> requirements;
+    requirements.reserve(upgrades.size());
     for (const auto& upair : upgrades)
     {
         const StatRequirementContainer* ureq = GetStatRequirements(upair.second, item);
-        if (EmptyRequirements(ureq))
-            continue;
-
-        for (const UpgradeStatReq& statReq : *ureq)
-        {
-            switch (statReq.reqType)
-            {
-                case REQ_TYPE_COPPER:
-                    copper += (uint32)statReq.reqVal1;
-                    break;
-                case REQ_TYPE_HONOR:
-                    honor += (uint32)statReq.reqVal1;
-                    break;
-                case REQ_TYPE_ARENA:
-                    arena += (uint32)statReq.reqVal1;
-                    break;
-                case REQ_TYPE_ITEM:
-                    itemMap[(uint32)statReq.reqVal1] += (uint32)statReq.reqVal2;
-                    break;
-            }
-        }
-    }
-
-    if (copper != 0)
-    {
-        if (copper > MAX_MONEY_AMOUNT)
-            copper = MAX_MONEY_AMOUNT;
-
-        reqs.push_back(UpgradeStatReq(0, REQ_TYPE_COPPER, (float)copper));
+        if (!EmptyRequirements(ureq))
+            requirements.push_back(ureq);
     }
 
-    if (honor != 0)
-        reqs.push_back(UpgradeStatReq(0, REQ_TYPE_HONOR, (float)honor));
-
-    if (arena != 0)
-        reqs.push_back(UpgradeStatReq(0, REQ_TYPE_ARENA, (float)arena));
-
-    for (const auto& ipair : itemMap)
-        reqs.push_back(UpgradeStatReq(0, REQ_TYPE_ITEM, (float)ipair.first, (float)ipair.second));
-
-    return reqs;
+    return ItemUpgradeEngine::BuildBulkRequirements(requirements, MAX_MONEY_AMOUNT);
 }
 
 std::unordered_map<uint32, const ItemUpgrade::UpgradeStat*> ItemUpgrade::FindAllUpgradeableRanks(const Player* player, const Item* item, float pct) const
 {
-    std::unordered_map<uint32, const UpgradeStat*> possibleUpgrades;
-    if (upgradesPctMap.find(pct) != upgradesPctMap.end())
-    {
-        const std::vector<const UpgradeStat*>& upgrades = upgradesPctMap.at(pct);
-        std::vector<_ItemStat> statInfoList = LoadItemStatInfo(item);
-        for (const UpgradeStat* stat : upgrades)
-        {
-            const _ItemStat* foundStat = GetStatByType(statInfoList, stat->statType);
-            if (foundStat == nullptr)
-                continue;
+    const UpgradeDefinitions& defs = GetDefinitions();
+    const auto& upgradesPctMap = defs.upgradesPctMap;
+    auto iter = upgradesPctMap.find(pct);
+    if (iter == upgradesPctMap.end())
+        return std::unordered_map<uint32, const UpgradeStat*>();
 
-            if (!IsAllowedStatType(stat->statType))
-                continue;
+    return ItemUpgradeEngine::FindAllUpgradeableRanks(iter->second, LoadItemStatInfo(item), defs.upgradeStatsByType,
+        [&](const UpgradeStat* stat) { return IsAllowedStatType(stat->statType) && CanApplyUpgradeForItem(item, stat); },
+        [&](uint32 statType) { return FindUpgradeForItem(player, item, statType); });
+}
 
-            if (!CanApplyUpgradeForItem(item, stat))
-                continue;
+/*static*/ bool ItemUpgrade::CompareIdentifier(const Identifier* a, const Identifier* b)
+{
+    if (a->GetType() == FLOAT_IDENTIFIER && b->GetType() == FLOAT_IDENTIFIER)
+        return ((FloatIdentifier*)a)->modPct < ((FloatIdentifier*)b)->modPct;
 
-            const UpgradeStat* currentUpgrade = FindUpgradeForItem(player, item, stat->statType);
-            if (currentUpgrade != nullptr)
-            {
-                const UpgradeStat* nextUpgrade = FindUpgradeStat(stat->statType, currentUpgrade->statRank + 1);
-                if (nextUpgrade != nullptr && currentUpgrade->statRank == stat->statRank - 1)
-                    possibleUpgrades[stat->statType] = stat;
-            }
-            else
-            {
-                if (stat->statRank == 1)
-                    possibleUpgrades[stat->statType] = stat;
-            }
-        }
-    }
-    return possibleUpgrades;
+    return a->name < b->name;
 }
 
-/*static*/ int32 ItemUpgrade::CalculateModPct(int32 value, const UpgradeStat* upgradeStat)
+/*static*/ const _ItemStat* ItemUpgrade::GetStatByType(const ItemStatInfo& statInfo, uint32 statType)
 {
-    int32 newAmount = (int32)(value * (1 + upgradeStat->statModPct / 100.0f));
-    return std::max(newAmount, value + upgradeStat->statRank);
+    return FindStatByType(statInfo, statType);
 }
 
-/*static*/ float ItemUpgrade::CalculateModPctF(float value, const UpgradeStat* upgradeStat)
+ItemUpgrade::ItemStatInfo ItemUpgrade::LoadItemStatInfo(const Item* item) const
 {
-    float newAmount = value * (1.0f + upgradeStat->statModPct / 100.0f);
-    return std::max(newAmount, value + upgradeStat->statRank);
+    return LoadItemStatInfo(item->GetTemplate(), item);
 }
 
-/*static*/ bool ItemUpgrade::CompareIdentifier(const Identifier* a, const Identifier* b)
+ItemUpgrade::ItemStatInfo ItemUpgrade::LoadItemStatInfo(const ItemTemplate* proto, const Item* item) const
 {
-    if (a->GetType() == FLOAT_IDENTIFIER && b->GetType() == FLOAT_IDENTIFIER)
-        return ((FloatIdentifier*)a)->modPct < ((FloatIdentifier*)b)->modPct;
+    uint32 cacheSize = GetIntConfig(CONFIG_ITEM_UPGRADE_STAT_INFO_CACHE_SIZE);
+    if (cacheSize == 0)
+        return ComputeItemStatInfo(proto, item);
 
-    return a->name < b->name;
-}
+    ItemStatInfoKey key{ proto->ItemId, item != nullptr ? item->GetItemRandomPropertyId() : 0, item != nullptr ? item->GetItemSuffixFactor() : 0 };
+    {
+        std::lock_guard<std::mutex> guard(itemStatInfoCacheLock);
+        auto iter = itemStatInfoCacheIndex.find(key);
+        if (iter != itemStatInfoCacheIndex.end())
+        {
+            itemStatInfoCache.splice(itemStatInfoCache.begin(), itemStatInfoCache, iter->second);
+            return iter->second->second;
+        }
+    }
 
-/*static*/ const _ItemStat* ItemUpgrade::GetStatByType(const std::vector<_ItemStat>& statInfo, uint32 statType)
-{
-    std::vector<_ItemStat>::const_iterator citer = std::find_if(statInfo.begin(), statInfo.end(), [&](const _ItemStat& stat) { return stat.ItemStatType == statType; });
-    if (citer != statInfo.end())
-        return &*citer;
-    return nullptr;
+    ItemStatInfo statInfo = ComputeItemStatInfo(proto, item);
+
+    std::lock_guard<std::mutex> guard(itemStatInfoCacheLock);
+    // another thread may have computed the same stats meanwhile
+    if (itemStatInfoCacheIndex.find(key) != itemStatInfoCacheIndex.end())
+        return statInfo;
+
+    itemStatInfoCache.emplace_front(key, statInfo);
+    itemStatInfoCacheIndex[key] = itemStatInfoCache.begin();
+    while (itemStatInfoCache.size() > cacheSize)
+    {
+        itemStatInfoCacheIndex.erase(itemStatInfoCache.back().first);
+        itemStatInfoCache.pop_back();
+    }
+
+    return statInfo;
 }
 
-/*static*/ std::vector<_ItemStat> ItemUpgrade::LoadItemStatInfo(const Item* item)
+/*static*/ ItemUpgrade::ItemStatInfo ItemUpgrade::ComputeItemStatInfo(const ItemTemplate* proto, const Item* item)
 {
-    std::vector<_ItemStat> statInfo;
-    ItemTemplate const* proto = item->GetTemplate();
+    ItemStatInfo statInfo;
 
     for (uint8 i = 0; i < MAX_ITEM_PROTO_STATS; ++i)
     {
@@ -2320,6 +2904,10 @@ std::unordered_map<uint32, const ItemUpgrade::UpgradeStat*> ItemUpgrade::FindAll
         }
     }
 
+    // a template alone has no random property enchantments
+    if (item == nullptr)
+        return statInfo;
+
     for (uint32 slot = PROP_ENCHANTMENT_SLOT_0; slot < MAX_ENCHANTMENT_SLOT; ++slot)
     {
         uint32 enchant_id = item->GetEnchantmentId(EnchantmentSlot(slot));
@@ -2438,31 +3026,53 @@ std::string ItemUpgrade::ItemLinkForUI(const Item* item, const Player* player) c
 
 const ItemUpgrade::UpgradeStat* ItemUpgrade::FindUpgradeStat(uint32 statId) const
 {
-    return _FindUpgradeStat(upgradeStatList, [&](const UpgradeStat& stat) { return stat.statId == statId; });
+    return GetDefinitions().FindUpgradeStat(statId);
 }
 
 const ItemUpgrade::UpgradeStat* ItemUpgrade::FindUpgradeStat(uint32 statType, uint16 rank) const
 {
-    return _FindUpgradeStat(upgradeStatList, [&](const UpgradeStat& stat) { return stat.statType == statType && stat.statRank == rank; });
+    if (statType >= MAX_ITEM_MOD)
+        return nullptr;
+
+    return ItemUpgradeEngine::FindUpgradeStat(GetDefinitions().upgradeStatsByType[statType], rank);
+}
+
+uint16 ItemUpgrade::GetMaxStatRank(uint32 statType) const
+{
+    if (statType >= MAX_ITEM_MOD)
+        return 0;
+
+    return (uint16)GetDefinitions().upgradeStatsByType[statType].size();
 }
 
 const ItemUpgrade::UpgradeStat* ItemUpgrade::FindWeaponUpgradeStat(float pct) const
 {
-    return _FindUpgradeStat(weaponUpgradeStats, [&](const UpgradeStat& stat) { return stat.statModPct == pct; });
+    return FindWeaponUpgradeStat(weaponUpgradeStats, pct);
+}
+
+/*static*/ const ItemUpgrade::UpgradeStat* ItemUpgrade::FindWeaponUpgradeStat(const UpgradeStatContainer& upgradeStats, float pct)
+{
+    UpgradeStatContainer::const_iterator citer = std::find_if(upgradeStats.begin(), upgradeStats.end(), [&](const UpgradeStat& stat) { return stat.statModPct == pct; });
+    return citer != upgradeStats.end() ? &*citer : nullptr;
 }
 
 const ItemUpgrade::UpgradeStat* ItemUpgrade::FindNearestWeaponUpgradeStat(float pct) const
 {
-    if (weaponUpgradeStats.empty())
+    return FindNearestWeaponUpgradeStat(weaponUpgradeStats, pct);
+}
+
+/*static*/ const ItemUpgrade::UpgradeStat* ItemUpgrade::FindNearestWeaponUpgradeStat(const UpgradeStatContainer& upgradeStats, float pct)
+{
+    if (upgradeStats.empty())
         return nullptr;
 
-    for (int i = weaponUpgradeStats.size() - 1; i >= 0; i--)
-        if (weaponUpgradeStats[i].statModPct < pct)
-            return &weaponUpgradeStats[i];
+    for (int i = upgradeStats.size() - 1; i >= 0; i--)
+        if (upgradeStats[i].statModPct < pct)
+            return &upgradeStats[i];
 
-    for (int i = 0; i < weaponUpgradeStats.size(); i++)
-        if (weaponUpgradeStats[i].statModPct > pct)
-            return &weaponUpgradeStats[i];
+    for (int i = 0; i < upgradeStats.size(); i++)
+        if (upgradeStats[i].statModPct > pct)
+            return &upgradeStats[i];
 
     return nullptr;
 }
@@ -2479,190 +3089,554 @@ const ItemUpgrade::UpgradeStat* ItemUpgrade::FindNextWeaponUpgradeStat(float pct
     return nullptr;
 }
 
-std::vector<const ItemUpgrade::UpgradeStat*> ItemUpgrade::_FindUpgradesForItem(const CharacterUpgradeContainer& characterUpgradeDataContainer, const Player* player, const Item* item) const
+/*static*/ ItemUpgrade::CharacterUpgradeState* ItemUpgrade::FindCharacterUpgradeState(const Player* player)
+{
+    // stat hooks come in bursts for the same player (_ApplyAllItemMods), the last state found by this thread is
+    // reused until any state is destroyed, so a new Player at the same address is never given a dangling state
+    thread_local const Player* cachedPlayer = nullptr;
+    thread_local CharacterUpgradeState* cachedState = nullptr;
+    thread_local uint32 cachedGeneration = 0;
+
+    uint32 generation = CharacterUpgradeStateGeneration.load(std::memory_order_acquire);
+    if (player == cachedPlayer && generation == cachedGeneration)
+        return cachedState;
+
+    CharacterUpgradeState* characterState = player->CustomData.Get<CharacterUpgradeState>(CHARACTER_UPGRADE_STATE_KEY);
+    if (characterState != nullptr)
+    {
+        cachedPlayer = player;
+        cachedState = characterState;
+        cachedGeneration = generation;
+    }
+    return characterState;
+}
+
+/*static*/ ItemUpgrade::CharacterUpgradeState& ItemUpgrade::GetCharacterUpgradeState(const Player* player)
+{
+    // created at OnPlayerLoadFromDB, every player that can reach the module has one
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    ASSERT(characterState != nullptr);
+    return *characterState;
+}
+
+ItemUpgrade::CharacterUpgradeState* ItemUpgrade::FindCharacterUpgradeState(uint32 guid)
+{
+    CharacterUpgradeStateShard& shard = GetCharacterUpgradeStateShard(guid);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    CharacterUpgradeStateContainer::const_iterator citer = shard.states.find(guid);
+    return citer != shard.states.end() ? citer->second : nullptr;
+}
+
+ItemUpgrade::CharacterUpgradeStateShard& ItemUpgrade::GetCharacterUpgradeStateShard(uint32 guid)
+{
+    return characterUpgradeStates[guid % CHARACTER_UPGRADE_STATE_SHARDS];
+}
+
+void ItemUpgrade::RegisterCharacterUpgradeState(CharacterUpgradeState* characterState)
+{
+    CharacterUpgradeStateShard& shard = GetCharacterUpgradeStateShard(characterState->guid);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.states[characterState->guid] = characterState;
+}
+
+void ItemUpgrade::UnregisterCharacterUpgradeState(const CharacterUpgradeState* characterState)
+{
+    CharacterUpgradeStateShard& shard = GetCharacterUpgradeStateShard(characterState->guid);
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    // a newer login of the same character may already have replaced it
+    CharacterUpgradeStateContainer::iterator iter = shard.states.find(characterState->guid);
+    if (iter != shard.states.end() && iter->second == characterState)
+        shard.states.erase(iter);
+}
+
+ItemUpgrade::CharacterUpgradeState::~CharacterUpgradeState()
+{
+    CharacterUpgradeStateGeneration.fetch_add(1, std::memory_order_release);
+    pagedData.Reset();
+    sItemUpgrade->UnregisterCharacterUpgradeState(this);
+}
+
+const ItemUpgrade::ItemUpgradeState* ItemUpgrade::FindItemUpgradeState(const Player* player, const Item* item) const
+{
+    return FindItemUpgradeState(FindCharacterUpgradeState(player), item);
+}
+
+/*static*/ const ItemUpgrade::ItemUpgradeState* ItemUpgrade::FindItemUpgradeState(const CharacterUpgradeState* characterState, const Item* item)
+{
+    if (characterState == nullptr)
+        return nullptr;
+
+    ItemUpgradeContainer::const_iterator citer = characterState->items.find(item->GetGUID().GetCounter());
+    if (citer == characterState->items.end())
+        return nullptr;
+
+    return &citer->second;
+}
+
+ItemUpgrade::ItemUpgradeState* ItemUpgrade::FindItemUpgradeState(const Player* player, const Item* item)
+{
+    return const_cast<ItemUpgradeState*>(static_cast<const ItemUpgrade*>(this)->FindItemUpgradeState(player, item));
+}
+
+ItemUpgrade::ItemUpgradeState& ItemUpgrade::GetOrCreateItemUpgradeState(const Player* player, const Item* item)
+{
+    return GetOrCreateItemUpgradeState(player, item->GetGUID().GetCounter());
+}
+
+ItemUpgrade::ItemUpgradeState& ItemUpgrade::GetOrCreateItemUpgradeState(const Player* player, ObjectGuid::LowType itemGuid)
+{
+    return GetCharacterUpgradeState(player).items[itemGuid];
+}
+
+void ItemUpgrade::SetItemUpgradeStat(ItemUpgradeState& state, const UpgradeStat* upgrade)
+{
+    if (upgrade->statType >= MAX_ITEM_MOD)
+        return;
+
+    state.InvalidateItemLevel();
+    const UpgradeStat*& slot = state.stats[upgrade->statType];
+    if (slot == nullptr)
+        state.statCount++;
+    slot = upgrade;
+}
+
+void ItemUpgrade::EraseItemUpgradeStateIfEmpty(const Player* player, const Item* item)
+{
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    if (characterState == nullptr)
+        return;
+
+    ItemUpgradeContainer::iterator iter = characterState->items.find(item->GetGUID().GetCounter());
+    if (iter != characterState->items.end() && iter->second.IsEmpty())
+        characterState->items.erase(iter);
+}
+
+std::vector<const ItemUpgrade::UpgradeStat*> ItemUpgrade::FindUpgradesForItem(const Player* player, const Item* item) const
 {
     std::vector<const UpgradeStat*> statsForItem;
-    if (characterUpgradeDataContainer.find(player->GetGUID().GetCounter()) == characterUpgradeDataContainer.end())
+    const ItemUpgradeState* state = FindItemUpgradeState(player, item);
+    if (state == nullptr || state->statCount == 0)
         return statsForItem;
 
-    const std::vector<CharacterUpgrade>& upgrades = characterUpgradeDataContainer.at(player->GetGUID().GetCounter());
-    for (auto const& upgrade : upgrades)
-        if (upgrade.itemGuid == item->GetGUID())
-            statsForItem.push_back(upgrade.upgradeStat);
+    statsForItem.reserve(state->statCount);
+    for (const UpgradeStat* upgradeStat : state->stats)
+        if (upgradeStat != nullptr)
+            statsForItem.push_back(upgradeStat);
 
     return statsForItem;
 }
 
-std::vector<const ItemUpgrade::UpgradeStat*> ItemUpgrade::FindUpgradesForItem(const Player* player, const Item* item) const
-{
-    return _FindUpgradesForItem(characterUpgradeData, player, item);
+const ItemUpgrade::UpgradeStat* ItemUpgrade::FindUpgradeForItem(const Player* player, const Item* item, uint32 statType) const
+{
+    if (statType >= MAX_ITEM_MOD)
+        return nullptr;
+
+    const ItemUpgradeState* state = FindItemUpgradeState(player, item);
+    if (state == nullptr)
+        return nullptr;
+
+    return state->stats[statType];
+}
+
+const ItemUpgrade::UpgradeStat* ItemUpgrade::FindUpgradeForWeapon(const Player* player, const Item* item) const
+{
+    const ItemUpgradeState* state = FindItemUpgradeState(player, item);
+    if (state == nullptr)
+        return nullptr;
+
+    return state->weaponUpgrade;
+}
+
+/*static*/ std::string ItemUpgrade::CopperToMoneyStr(uint64 money, bool colored)
+{
+    uint64 gold = money / GOLD;
+    uint32 silver = uint32((money % GOLD) / SILVER);
+    uint32 copper = uint32((money % GOLD) % SILVER);
+
+    std::ostringstream oss;
+    if (gold > 0)
+    {
+        if (colored)
+            oss << gold << "|cffb3aa34g|r";
+        else
+            oss << gold << "g";
+    }
+    if (silver > 0)
+    {
+        if (colored)
+            oss << silver << "|cff7E7C7Fs|r";
+        else
+            oss << silver << "s";
+    }
+    if (copper > 0)
+    {
+        if (colored)
+            oss << copper << "|cff974B29c|r";
+        else
+            oss << copper << "c";
+    }
+
+    return oss.str();
+}
+
+/*static*/ std::string ItemUpgrade::FormatFloat(float val, uint32 decimals)
+{
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(decimals) << val;
+    return oss.str();
+}
+
+/*static*/ std::string ItemUpgrade::FormatIncrease(float prev, float next)
+{
+    std::ostringstream oss;
+    oss << "[";
+    oss << "|cffb50505" << FormatFloat(prev) << "|r ";
+    oss << "--> ";
+    oss << "|cff056e3a" << FormatFloat(next) << "|r";
+    oss << "]";
+    return oss.str();
+}
+
+void ItemUpgrade::SetReloading(bool value)
+{
+    reloading = value;
+}
+
+bool ItemUpgrade::GetReloading() const
+{
+    return reloading;
+}
+
+/*static*/ ItemUpgrade::InventoryScope ItemUpgrade::GetInventoryScope(const Item* item)
+{
+    uint8 bagSlot = item->GetBagSlot();
+    uint8 slot = item->GetSlot();
+    if (bagSlot == INVENTORY_SLOT_BAG_0)
+    {
+        if (slot >= EQUIPMENT_SLOT_START && slot < EQUIPMENT_SLOT_END)
+            return INVENTORY_SCOPE_EQUIPPED;
+        if (slot >= INVENTORY_SLOT_ITEM_START && slot < INVENTORY_SLOT_ITEM_END)
+            return INVENTORY_SCOPE_BACKPACK;
+        if (slot >= BANK_SLOT_ITEM_START && slot < BANK_SLOT_ITEM_END)
+            return INVENTORY_SCOPE_BANK;
+        return INVENTORY_SCOPE_NONE;
+    }
+
+    if (bagSlot >= INVENTORY_SLOT_BAG_START && bagSlot < INVENTORY_SLOT_BAG_END)
+        return INVENTORY_SCOPE_BAGS;
+    if (bagSlot >= BANK_SLOT_BAG_START && bagSlot < BANK_SLOT_BAG_END)
+        return INVENTORY_SCOPE_BANK_BAGS;
+    return INVENTORY_SCOPE_NONE;
+}
+
+/*static*/ Item* ItemUpgrade::FindIndexedItem(const Player* player, ObjectGuid::LowType itemGuid, uint16& pos)
+{
+    // most items did not move since last time, that is a direct slot lookup instead of a walk through the whole inventory
+    if (pos != NULL_SLOT)
+        if (Item* item = player->GetItemByPos(pos))
+            if (item->GetGUID().GetCounter() == itemGuid)
+                return item;
+
+    Item* item = player->GetItemByGuid(ObjectGuid::Create<HighGuid::Item>(itemGuid));
+    pos = item != nullptr ? item->GetPos() : NULL_SLOT;
+    return item;
+}
+
+/*static*/ std::string ItemUpgrade::InventoryScopeToString(InventoryScope scope)
+{
+    switch (scope)
+    {
+        case INVENTORY_SCOPE_BACKPACK:
+            return "backpack";
+        case INVENTORY_SCOPE_BAGS:
+            return "bags";
+        case INVENTORY_SCOPE_EQUIPPED:
+            return "equipped";
+        case INVENTORY_SCOPE_BANK:
+            return "bank";
+        case INVENTORY_SCOPE_BANK_BAGS:
+            return "bank bags";
+        default:
+            return "";
+    }
+}
+
+bool ItemUpgrade::IsAllowedItem(const Item* item) const
+{
+    return GetDefinitions().IsAllowedItem(item->GetEntry());
+}
+
+bool ItemUpgrade::UpgradeDefinitions::IsAllowedItem(uint32 entry) const
+{
+    if (entry < itemTemplateFlags.size())
+        return (itemTemplateFlags[entry] & ITEM_TEMPLATE_FLAG_ALLOWED) != 0;
+
+    if (allowedItems.empty())
+        return true;
+
+    return allowedItems.find(entry) != allowedItems.end();
 }
 
-const ItemUpgrade::UpgradeStat* ItemUpgrade::FindUpgradeForItem(const Player* player, const Item* item, uint32 statType) const
+bool ItemUpgrade::IsBlacklistedItem(const Item* item) const
 {
-    std::vector<const UpgradeStat*> statsForItem = FindUpgradesForItem(player, item);
-    if (statsForItem.empty())
-        return nullptr;
-
-    std::vector<const UpgradeStat*>::const_iterator citer = std::find_if(statsForItem.begin(), statsForItem.end(), [&](const UpgradeStat* upgradeStat) { return upgradeStat->statType == statType; });
-    if (citer != statsForItem.end())
-        return *citer;
-
-    return nullptr;
+    return GetDefinitions().IsBlacklistedItem(item->GetEntry());
 }
 
-const ItemUpgrade::UpgradeStat* ItemUpgrade::FindUpgradeForWeapon(const Player* player, const Item* item) const
+bool ItemUpgrade::UpgradeDefinitions::IsBlacklistedItem(uint32 entry) const
 {
-    std::vector<const UpgradeStat*> weaponUpgrades = _FindUpgradesForItem(characterWeaponUpgradeData, player, item);
-    if (weaponUpgrades.empty())
-        return nullptr;
+    if (entry < itemTemplateFlags.size())
+        return (itemTemplateFlags[entry] & ITEM_TEMPLATE_FLAG_BLACKLISTED) != 0;
+
+    if (blacklistedItems.empty())
+        return false;
 
-    return weaponUpgrades[0];
+    return blacklistedItems.find(entry) != blacklistedItems.end();
 }
 
-/*static*/ std::string ItemUpgrade::CopperToMoneyStr(uint32 money, bool colored)
+uint64 ItemUpgrade::ItemQueryValues::Signature() const
 {
-    uint32 gold = money / GOLD;
-    uint32 silver = (money % GOLD) / SILVER;
-    uint32 copper = (money % GOLD) % SILVER;
-
-    std::ostringstream oss;
-    if (gold > 0)
-    {
-        if (colored)
-            oss << gold << "|cffb3aa34g|r";
-        else
-            oss << gold << "g";
-    }
-    if (silver > 0)
+    // FNV-1a over the fields upgrades can change
+    uint64 hash = 14695981039346656037ULL;
+    auto combine = [&hash](const void* data, std::size_t size)
     {
-        if (colored)
-            oss << silver << "|cff7E7C7Fs|r";
-        else
-            oss << silver << "s";
-    }
-    if (copper > 0)
+        const uint8* bytes = static_cast<const uint8*>(data);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+
+    combine(&itemLevel, sizeof(itemLevel));
+    combine(statValues.data(), statValues.size() * sizeof(int32));
+    for (const std::pair<float, float>& damage : damages)
     {
-        if (colored)
-            oss << copper << "|cff974B29c|r";
-        else
-            oss << copper << "c";
+        combine(&damage.first, sizeof(float));
+        combine(&damage.second, sizeof(float));
     }
+    return hash;
+}
 
-    return oss.str();
+/*static*/ ItemUpgrade::ItemQueryValues ItemUpgrade::GetTemplateQueryValues(const ItemTemplate* proto)
+{
+    ItemQueryValues values;
+    values.itemLevel = proto->ItemLevel;
+    values.statValues.fill(0);
+    for (uint32 i = 0; i < proto->StatsCount && i < MAX_ITEM_PROTO_STATS; ++i)
+        values.statValues[i] = proto->ItemStat[i].ItemStatValue;
+    for (int i = 0; i < MAX_ITEM_PROTO_DAMAGES; ++i)
+        values.damages[i] = std::make_pair(proto->Damage[i].DamageMin, proto->Damage[i].DamageMax);
+    return values;
 }
 
-/*static*/ std::string ItemUpgrade::FormatFloat(float val, uint32 decimals)
+ItemUpgrade::ItemQueryValues ItemUpgrade::GetItemQueryValues(const Player* player, Item* item) const
 {
-    std::ostringstream oss;
-    oss << std::fixed << std::setprecision(decimals) << val;
-    return oss.str();
+    return GetItemQueryValues(item->GetTemplate(), item, FindItemUpgradeState(player, item), FindPendingModifierSources(player));
 }
 
-/*static*/ std::string ItemUpgrade::FormatIncrease(float prev, float next)
+ItemUpgrade::ItemQueryValues ItemUpgrade::GetItemQueryValues(const ItemTemplate* proto, const Item* item, const ItemUpgradeState* state, const ModifierSources* pendingSources) const
 {
-    std::ostringstream oss;
-    oss << "[";
-    oss << "|cffb50505" << FormatFloat(prev) << "|r ";
-    oss << "--> ";
-    oss << "|cff056e3a" << FormatFloat(next) << "|r";
-    oss << "]";
-    return oss.str();
+    ItemQueryValues values = GetTemplateQueryValues(proto);
+
+    // items without upgrades are sent exactly as their template
+    if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_SEND_PACKETS) || state == nullptr)
+        return values;
+
+    if (proto->StatsCount > 0)
+        values.itemLevel = GetItemLevel(proto, item, state, pendingSources);
+    for (uint32 i = 0; i < proto->StatsCount && i < MAX_ITEM_PROTO_STATS; ++i)
+        values.statValues[i] = ModifyStat(proto->ItemId, state, pendingSources, proto->ItemStat[i].ItemStatType, proto->ItemStat[i].ItemStatValue);
+    for (int i = 0; i < MAX_ITEM_PROTO_DAMAGES; ++i)
+        values.damages[i] = ModifyWeaponDamage(proto->ItemId, state, pendingSources, proto->Damage[i].DamageMin, proto->Damage[i].DamageMax);
+    return values;
 }
 
-void ItemUpgrade::SetReloading(bool value)
+bool ItemUpgrade::SendItemPacket(Player* player, Item* item)
 {
-    reloading = value;
+    return SendItemPacket(player, item->GetTemplate(), item);
 }
 
-bool ItemUpgrade::GetReloading() const
+bool ItemUpgrade::SendItemPacket(Player* player, const ItemTemplate* proto, Item* item)
 {
-    return reloading;
+    ItemUpgradeProfileScope profile(PROFILE_SEND_ITEM_PACKET);
+
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    bool wasUpgraded = characterState != nullptr && characterState->upgradedClientEntries.find(proto->ItemId) != characterState->upgradedClientEntries.end();
+
+    WorldSession* session = player->GetSession();
+    bool sent = SendItemPacket(characterState, proto, item, item != nullptr ? FindItemUpgradeState(player, item) : nullptr, FindPendingModifierSources(player),
+        session->GetSessionDbLocaleIndex(), [session](const WorldPacket* packet) { session->SendPacket(packet); });
+    if (!sent)
+        return false;
+
+    CountMetric(METRIC_COUNTER_ITEM_PACKETS);
+
+    // what the client caches outlives the session, so does the record of it
+    bool isUpgraded = characterState != nullptr && characterState->upgradedClientEntries.find(proto->ItemId) != characterState->upgradedClientEntries.end();
+    if (isUpgraded && !wasUpgraded)
+        ExecuteUpgradeWrite(nullptr, Acore::StringFormat("INSERT IGNORE INTO character_item_upgrade_sent (guid, entry) VALUES ({}, {})", characterState->guid, proto->ItemId));
+    else if (!isUpgraded && wasUpgraded)
+        ExecuteUpgradeWrite(nullptr, Acore::StringFormat("DELETE FROM character_item_upgrade_sent WHERE guid = {} AND entry = {}", characterState->guid, proto->ItemId));
+
+    return true;
 }
 
-void ItemUpgrade::HandleDataReload(bool apply)
+void ItemUpgrade::ResetClientEntries(Player* player, const std::vector<Item*>& visualItems)
 {
-    const WorldSessionMgr::SessionMap& sessions = sWorldSessionMgr->GetAllSessions();
-    WorldSessionMgr::SessionMap::const_iterator itr;
-    for (itr = sessions.begin(); itr != sessions.end(); ++itr)
-        if (itr->second && itr->second->GetPlayer() && itr->second->GetPlayer()->IsInWorld())
-            HandleDataReload(itr->second->GetPlayer(), apply);
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    if (characterState == nullptr || characterState->upgradedClientEntries.empty())
+        return;
+
+    // entries still upgraded somewhere are resent by the visual items, bank ones once a banker is opened
+    std::unordered_set<uint32> upgradedEntries;
+    for (Item* item : visualItems)
+        upgradedEntries.insert(item->GetEntry());
+    for (auto& indexed : characterState->items)
+        if (Item* item = FindIndexedItem(player, indexed.first, indexed.second.pos))
+            upgradedEntries.insert(item->GetEntry());
+
+    std::vector<uint32> staleEntries;
+    for (uint32 entry : characterState->upgradedClientEntries)
+        if (upgradedEntries.find(entry) == upgradedEntries.end())
+            staleEntries.push_back(entry);
+
+    for (uint32 entry : staleEntries)
+    {
+        if (const ItemTemplate* proto = sObjectMgr->GetItemTemplate(entry))
+            SendItemPacket(player, proto, nullptr);
+        else
+        {
+            characterState->upgradedClientEntries.erase(entry);
+            ExecuteUpgradeWrite(nullptr, Acore::StringFormat("DELETE FROM character_item_upgrade_sent WHERE guid = {} AND entry = {}", characterState->guid, entry));
+        }
+    }
 }
 
-void ItemUpgrade::HandleDataReload(Player* player, bool apply)
+bool ItemUpgrade::SendItemPacket(CharacterUpgradeState* characterState, const ItemTemplate* proto, const Item* item, const ItemUpgradeState* state,
+    const ModifierSources* pendingSources, int loc_idx, const ItemPacketSink& sink)
 {
-    std::vector<Item*> playerItems = GetPlayerItems(player, true);
-    std::vector<Item*>::iterator iter = playerItems.begin();
-    for (iter; iter != playerItems.end(); ++iter)
+    ItemQueryValues values = GetItemQueryValues(proto, item, state, pendingSources);
+
+    uint64 signature = values.Signature();
+
+    // skip entries the client already has: what was sent last in this session, otherwise the template unless an earlier session sent more
+    if (characterState != nullptr)
     {
-        Item* item = *iter;
+        std::unordered_map<uint32, uint64>& sentItemQueries = characterState->sentItemQueries;
+        std::unordered_set<uint32>& upgradedClientEntries = characterState->upgradedClientEntries;
+        std::unordered_map<uint32, uint64>::const_iterator sentIter = sentItemQueries.find(proto->ItemId);
+        if (sentIter != sentItemQueries.end() && sentIter->second == signature)
+            return false;
 
-        if (!item->IsEquipped())
-            continue;
+        uint64 templateSignature = GetTemplateQueryValues(proto).Signature();
+        bool upgradedClientEntry = upgradedClientEntries.find(proto->ItemId) != upgradedClientEntries.end();
+        if (sentIter == sentItemQueries.end() && !upgradedClientEntry && templateSignature == signature)
+            return false;
 
-        player->_ApplyItemMods(item, item->GetSlot(), apply);
+        sentItemQueries[proto->ItemId] = signature;
+        if (templateSignature != signature)
+            upgradedClientEntries.insert(proto->ItemId);
+        else if (upgradedClientEntry)
+            upgradedClientEntries.erase(proto->ItemId);
     }
 
-    if (apply)
-        UpdateVisualCache(player);
+    SendItemQueryResponse(proto, loc_idx, values, signature, sink);
+    return true;
 }
 
-std::vector<Item*> ItemUpgrade::GetPlayerItems(const Player* player, bool inBankAlso) const
+void ItemUpgrade::SendItemQueryResponse(const ItemTemplate* proto, int loc_idx, const ItemQueryValues& values, uint64 signature, const ItemPacketSink& sink)
 {
-    std::vector<Item*> items;
-    for (uint8 i = INVENTORY_SLOT_ITEM_START; i < INVENTORY_SLOT_ITEM_END; i++)
-        if (Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, i))
-            items.push_back(item);
+    uint32 cacheSize = GetIntConfig(CONFIG_ITEM_UPGRADE_ITEM_QUERY_CACHE_SIZE);
+    ItemQueryCacheKey key{ proto->ItemId, loc_idx, signature };
+    if (cacheSize > 0)
+    {
+        // the packet is kept alive by the reference taken here, the sink runs without holding the lock
+        std::shared_ptr<const WorldPacket> cached;
+        {
+            std::lock_guard<std::mutex> guard(itemQueryCacheLock);
+            auto iter = itemQueryCacheIndex.find(key);
+            if (iter != itemQueryCacheIndex.end())
+            {
+                itemQueryCache.splice(itemQueryCache.begin(), itemQueryCache, iter->second);
+                cached = iter->second->second;
+            }
+        }
 
-    for (uint8 i = INVENTORY_SLOT_BAG_START; i < INVENTORY_SLOT_BAG_END; i++)
-        if (Bag* bag = player->GetBagByPos(i))
-            for (uint32 j = 0; j < bag->GetBagSize(); j++)
-                if (Item* item = player->GetItemByPos(i, j))
-                    items.push_back(item);
+        if (cached)
+        {
+            sink(cached.get());
+            return;
+        }
+    }
 
-    for (uint8 i = EQUIPMENT_SLOT_START; i < EQUIPMENT_SLOT_END; i++)
-        if (Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, i))
-            items.push_back(item);
+    std::shared_ptr<const WorldPacket> queryData = std::make_shared<const WorldPacket>(BuildItemQueryResponse(proto, loc_idx, values));
+    sink(queryData.get());
 
-    if (inBankAlso)
-    {
-        for (uint8 i = BANK_SLOT_ITEM_START; i < BANK_SLOT_ITEM_END; i++)
-            if (Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, i))
-                items.push_back(item);
+    if (cacheSize == 0)
+        return;
 
-        for (uint8 i = BANK_SLOT_BAG_START; i < BANK_SLOT_BAG_END; i++)
-            if (Bag* bag = player->GetBagByPos(i))
-                for (uint32 j = 0; j < bag->GetBagSize(); j++)
-                    if (Item* item = player->GetItemByPos(i, j))
-                        items.push_back(item);
-    }
+    std::lock_guard<std::mutex> guard(itemQueryCacheLock);
+    // another thread may have built the same response meanwhile
+    if (itemQueryCacheIndex.find(key) != itemQueryCacheIndex.end())
+        return;
 
-    return items;
+    itemQueryCache.emplace_front(key, std::move(queryData));
+    itemQueryCacheIndex[key] = itemQueryCache.begin();
+    while (itemQueryCache.size() > cacheSize)
+    {
+        itemQueryCacheIndex.erase(itemQueryCache.back().first);
+        itemQueryCache.pop_back();
+    }
 }
 
-bool ItemUpgrade::IsAllowedItem(const Item* item) const
+void ItemUpgrade::ClearItemQueryCache()
 {
-    if (allowedItems.empty())
-        return true;
-
-    return allowedItems.find(item->GetEntry()) != allowedItems.end();
+    // serialized templates only depend on the ItemTemplate and the locale, they survive reloads
+    std::lock_guard<std::mutex> guard(itemQueryCacheLock);
+    itemQueryCache.clear();
+    itemQueryCacheIndex.clear();
 }
 
-bool ItemUpgrade::IsBlacklistedItem(const Item* item) const
+WorldPacket ItemUpgrade::BuildItemQueryResponse(const ItemTemplate* proto, int loc_idx, const ItemQueryValues& values)
 {
-    if (blacklistedItems.empty())
-        return false;
+    WorldPacket queryData;
+    std::size_t itemLevelPos;
+    std::array<std::size_t, MAX_ITEM_PROTO_STATS> statValuePos;
+    std::array<std::pair<std::size_t, std::size_t>, MAX_ITEM_PROTO_DAMAGES> damagePos;
+    {
+        std::lock_guard<std::mutex> guard(itemQueryCacheLock);
+        ItemQueryTemplateContainer::iterator iter = itemQueryTemplates.find(std::make_pair(proto->ItemId, loc_idx));
+        if (iter == itemQueryTemplates.end())
+            iter = itemQueryTemplates.emplace(std::make_pair(proto->ItemId, loc_idx), SerializeItemQueryTemplate(proto, loc_idx)).first;
+
+        queryData = iter->second.packet;
+        itemLevelPos = iter->second.itemLevelPos;
+        statValuePos = iter->second.statValuePos;
+        damagePos = iter->second.damagePos;
+    }
+
+    // only the upgradable fields differ from the template, they are written in place
+    queryData.put<uint32>(itemLevelPos, values.itemLevel);
+    for (uint32 i = 0; i < proto->StatsCount && i < MAX_ITEM_PROTO_STATS; ++i)
+        queryData.put<int32>(statValuePos[i], values.statValues[i]);
+    for (int i = 0; i < MAX_ITEM_PROTO_DAMAGES; ++i)
+    {
+        queryData.put<float>(damagePos[i].first, values.damages[i].first);
+        queryData.put<float>(damagePos[i].second, values.damages[i].second);
+    }
 
-    return blacklistedItems.find(item->GetEntry()) != blacklistedItems.end();
+    return queryData;
 }
 
-void ItemUpgrade::SendItemPacket(Player* player, Item* item) const
+/*static*/ ItemUpgrade::ItemQueryTemplate ItemUpgrade::SerializeItemQueryTemplate(const ItemTemplate* pProto, int loc_idx)
 {
-    ItemTemplate const* pProto = sObjectMgr->GetItemTemplate(item->GetEntry());
+    ItemQueryTemplate queryTemplate;
+    queryTemplate.statValuePos.fill(0);
+
     std::string Name = pProto->Name1;
     std::string Description = pProto->Description;
 
-    int loc_idx = player->GetSession()->GetSessionDbLocaleIndex();
     if (loc_idx >= 0)
     {
         if (ItemLocale const* il = sObjectMgr->GetItemLocale(pProto->ItemId))
@@ -2672,7 +3646,8 @@ void ItemUpgrade::SendItemPacket(Player* player, Item* item) const
         }
     }
     // guess size
-    WorldPacket queryData(SMSG_ITEM_QUERY_SINGLE_RESPONSE, 600);
+    WorldPacket& queryData = queryTemplate.packet;
+    queryData.Initialize(SMSG_ITEM_QUERY_SINGLE_RESPONSE, 600);
     queryData << pProto->ItemId;
     queryData << pProto->Class;
     queryData << pProto->SubClass;
@@ -2690,10 +3665,8 @@ void ItemUpgrade::SendItemPacket(Player* player, Item* item) const
     queryData << pProto->InventoryType;
     queryData << pProto->AllowableClass;
     queryData << pProto->AllowableRace;
-    if (GetBoolConfig(CONFIG_ITEM_UPGRADE_SEND_PACKETS) && pProto->StatsCount > 0)
-        queryData << CalculateItemLevel(player, item).second;
-    else
-        queryData << pProto->ItemLevel;
+    queryTemplate.itemLevelPos = queryData.wpos();
+    queryData << pProto->ItemLevel;
     queryData << pProto->RequiredLevel;
     queryData << pProto->RequiredSkill;
     queryData << pProto->RequiredSkillRank;
@@ -2709,27 +3682,18 @@ void ItemUpgrade::SendItemPacket(Player* player, Item* item) const
     for (uint32 i = 0; i < pProto->StatsCount; ++i)
     {
         queryData << pProto->ItemStat[i].ItemStatType;
-        if (GetBoolConfig(CONFIG_ITEM_UPGRADE_SEND_PACKETS))
-            queryData << HandleStatModifier(player, item, pProto->ItemStat[i].ItemStatType, pProto->ItemStat[i].ItemStatValue, MAX_ENCHANTMENT_SLOT);
-        else
-            queryData << pProto->ItemStat[i].ItemStatValue;
+        if (i < MAX_ITEM_PROTO_STATS)
+            queryTemplate.statValuePos[i] = queryData.wpos();
+        queryData << pProto->ItemStat[i].ItemStatValue;
     }
     queryData << pProto->ScalingStatDistribution;            // scaling stats distribution
     queryData << pProto->ScalingStatValue;                   // some kind of flags used to determine stat values column
     for (int i = 0; i < MAX_ITEM_PROTO_DAMAGES; ++i)
     {
-        if (GetBoolConfig(CONFIG_ITEM_UPGRADE_SEND_PACKETS))
-        {
-            std::pair<float, float> upgradedDmgInfo = HandleWeaponModifier(player, item, pProto->Damage[i].DamageMin, pProto->Damage[i].DamageMax);
-            queryData << upgradedDmgInfo.first;
-            queryData << upgradedDmgInfo.second;
-        }
-        else
-        {
-            queryData << pProto->Damage[i].DamageMin;
-            queryData << pProto->Damage[i].DamageMax;
-        }
-        
+        queryTemplate.damagePos[i].first = queryData.wpos();
+        queryData << pProto->Damage[i].DamageMin;
+        queryTemplate.damagePos[i].second = queryData.wpos();
+        queryData << pProto->Damage[i].DamageMax;
         queryData << pProto->Damage[i].DamageType;
     }
 
@@ -2812,75 +3776,257 @@ void ItemUpgrade::SendItemPacket(Player* player, Item* item) const
     queryData << pProto->Duration;                           // added in 2.4.2.8209, duration (seconds)
     queryData << pProto->ItemLimitCategory;                  // WotLK, ItemLimitCategory
     queryData << pProto->HolidayId;                          // Holiday.dbc?
-    player->GetSession()->SendPacket(&queryData);
+    return queryTemplate;
+}
+
+void ItemUpgrade::UpdateVisualCache(Player* player, bool force)
+{
+    ItemUpgradeProfileScope profile(PROFILE_UPDATE_VISUAL_CACHE);
+
+    bool inBankAlso = force;
+    if (CharacterUpgradeState* characterState = FindCharacterUpgradeState(player))
+    {
+        // an explicit refresh resends everything that differs from the template, whatever the client was sent before
+        if (force)
+        {
+            characterState->sentItemQueries.clear();
+            characterState->bankItemsSent = true;
+        }
+        inBankAlso = characterState->bankItemsSent;
+    }
+
+    std::vector<Item*> visualItems = ChooseVisualItems(player, inBankAlso);
+    for (Item* item : visualItems)
+        SendItemPacket(player, item);
+
+    if (force)
+        ResetClientEntries(player, visualItems);
+}
+
+void ItemUpgrade::QueueVisualCacheUpdate(Player* player)
+{
+    // bank items wait for QueueBankVisualCacheUpdate
+    std::vector<Item*> visualItems = ChooseVisualItems(player, false);
+    ResetClientEntries(player, visualItems);
+    QueueItemPackets(player, visualItems, false);
+}
+
+void ItemUpgrade::QueueBankVisualCacheUpdate(Player* player)
+{
+    CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    if (characterState == nullptr || !characterState->IsLoaded() || characterState->bankItemsSent)
+        return;
+
+    characterState->bankItemsSent = true;
+
+    // the visual item of an entry is chosen among bank and inventory, only the bank ones are still missing
+    QueueItemPackets(player, ChooseVisualItems(player, true), true);
 }
 
-void ItemUpgrade::UpdateVisualCache(Player* player)
+void ItemUpgrade::QueueItemPackets(Player* player, const std::vector<Item*>& items, bool bankOnly)
 {
-    std::map<uint32, std::vector<ItemUpgradeInfo>> entryUpgradeMap;
-    std::vector<Item*> items = GetPlayerItems(player, true);
-    std::vector<Item*>::const_iterator citer = items.begin();
-    for (citer; citer != items.end(); ++citer)
+    if (GetIntConfig(CONFIG_ITEM_UPGRADE_LOGIN_PACKETS_PER_UPDATE) == 0)
+    {
+        for (Item* item : items)
+            if (!bankOnly || GetItemPacketPriority(item) == ITEM_PACKET_PRIORITY_BANK)
+                SendItemPacket(player, item);
+        return;
+    }
+
+    uint32 now = getMSTime();
+    const CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+
+    std::lock_guard<std::mutex> guard(itemPacketQueueLock);
+    for (const Item* item : items)
     {
-        const Item* item = *citer;
-        ItemUpgradeInfo upgradeInfo;
-        upgradeInfo.itemGuid = item->GetGUID();
-        upgradeInfo.upgrades = FindUpgradesForItem(player, item);
-        upgradeInfo.weaponUpgrade = FindUpgradeForWeapon(player, item);
-        entryUpgradeMap[item->GetEntry()].push_back(upgradeInfo);
+        if (bankOnly && GetItemPacketPriority(item) != ITEM_PACKET_PRIORITY_BANK)
+            continue;
+
+        // without upgrades the client keeps the template, nothing to send unless an earlier session sent it upgraded
+        if (FindItemUpgradeState(player, item) == nullptr
+            && (characterState == nullptr || characterState->upgradedClientEntries.find(item->GetEntry()) == characterState->upgradedClientEntries.end()))
+            continue;
+
+        itemPacketQueue[GetItemPacketPriority(item)].push_back({ player->GetGUID(), item->GetGUID(), now });
     }
+}
+
+void ItemUpgrade::UpdateItemPacketQueue()
+{
+    uint32 budget = GetIntConfig(CONFIG_ITEM_UPGRADE_LOGIN_PACKETS_PER_UPDATE);
 
-    auto chooseVisualItem = [&](const uint32 entry) -> const ItemUpgradeInfo* {
-        auto emptyUpgrade = [](const ItemUpgradeInfo* itemUpgradeInfo)
+    std::lock_guard<std::mutex> guard(itemPacketQueueLock);
+    uint32 sent = 0;
+    for (std::deque<QueuedItemPacket>& queue : itemPacketQueue)
+    {
+        while (!queue.empty() && (budget == 0 || sent < budget))
         {
-            return itemUpgradeInfo->upgrades.empty() && itemUpgradeInfo->weaponUpgrade == nullptr;
-        };
+            QueuedItemPacket queued = queue.front();
+            queue.pop_front();
+
+            // logged out or item gone meanwhile
+            Player* player = ObjectAccessor::FindConnectedPlayer(queued.playerGuid);
+            if (!player || !player->IsInWorld())
+                continue;
+
+            Item* item = player->GetItemByGuid(queued.itemGuid);
+            if (!item || !SendItemPacket(player, item))
+                continue;
+
+            uint32 latency = getMSTimeDiff(queued.queueTime, getMSTime());
+            itemPacketQueueSent++;
+            itemPacketQueueLatencySum += latency;
+            itemPacketQueueMaxLatency = std::max(itemPacketQueueMaxLatency, latency);
+            sent++;
+        }
+    }
+}
 
-        const std::vector<ItemUpgradeInfo>& upgradeInfo = entryUpgradeMap.at(entry);
-        const ItemUpgradeInfo* highestStatUpgrade = &upgradeInfo[0];
-        const ItemUpgradeInfo* highestWeaponUpgrade = &upgradeInfo[0];
-        for (size_t i = 1; i < upgradeInfo.size(); i++)
+ItemUpgrade::ItemPacketQueueStats ItemUpgrade::GetItemPacketQueueStats() const
+{
+    std::lock_guard<std::mutex> guard(itemPacketQueueLock);
+
+    ItemPacketQueueStats stats;
+    for (uint32 i = 0; i < MAX_ITEM_PACKET_PRIORITY; i++)
+        stats.depth[i] = itemPacketQueue[i].size();
+    stats.sentPackets = itemPacketQueueSent;
+    stats.averageLatency = itemPacketQueueSent > 0 ? uint32(itemPacketQueueLatencySum / itemPacketQueueSent) : 0;
+    stats.maxLatency = itemPacketQueueMaxLatency;
+    return stats;
+}
+
+void ItemUpgrade::CountMetric(MetricCounter counter) const
+{
+    metricCounters[counter].fetch_add(1, std::memory_order_relaxed);
+}
+
+void ItemUpgrade::UpdateMetrics(uint32 diff)
+{
+    if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_METRICS))
+        return;
+
+    metricsTimer += diff;
+    if (metricsTimer < (uint32)GetIntConfig(CONFIG_ITEM_UPGRADE_METRICS_INTERVAL))
+        return;
+    metricsTimer = 0;
+
+    static const std::array<std::string, MAX_METRIC_COUNTERS> counterNames =
+    {
+        "item_upgrade_purchases",
+        "item_upgrade_random_upgrades",
+        "item_upgrade_item_packets",
+        "item_upgrade_db_writes"
+    };
+
+    // counters are sent as what happened since the previous sample
+    for (uint32 i = 0; i < MAX_METRIC_COUNTERS; i++)
+    {
+        uint64 total = metricCounters[i].load(std::memory_order_relaxed);
+        METRIC_VALUE(counterNames[i], total - sampledMetricCounters[i]);
+        sampledMetricCounters[i] = total;
+    }
+
+    uint64 characters = 0;
+    uint64 items = 0;
+    uint64 journal = 0;
+    uint64 pagedData = 0;
+    VisitCharacterUpgradeStates([&](const CharacterUpgradeState& characterState)
+    {
+        characters++;
+        items += characterState.items.size();
+        journal += characterState.journal.size();
+        pagedData += characterState.pagedData.data.size();
+    });
+    METRIC_VALUE("item_upgrade_characters", characters);
+    METRIC_VALUE("item_upgrade_items", items);
+    METRIC_VALUE("item_upgrade_journal", journal);
+    METRIC_VALUE("item_upgrade_paged_data", pagedData);
+}
+
+/*static*/ ItemUpgrade::ItemPacketPriority ItemUpgrade::GetItemPacketPriority(const Item* item)
+{
+    if (item->IsEquipped())
+        return ITEM_PACKET_PRIORITY_EQUIPPED;
+
+    if (Player::IsBankPos(item->GetBagSlot(), item->GetSlot()))
+        return ITEM_PACKET_PRIORITY_BANK;
+
+    return ITEM_PACKET_PRIORITY_BAGS;
+}
+
+std::vector<Item*> ItemUpgrade::ChooseVisualItems(const Player* player, bool inBankAlso) const
+{
+    // one flat record per item, scored from its upgrade state, no per item allocation and no lookup by GUID afterwards
+    struct VisualCandidate
+    {
+        uint32 entry;
+        uint32 order;
+        Item* item;
+        uint32 statCount;
+        const UpgradeStat* weaponUpgrade;
+    };
+
+    const CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+    std::vector<VisualCandidate> candidates;
+    VisitPlayerItems(player, inBankAlso ? INVENTORY_SCOPE_ALL : INVENTORY_SCOPE_INVENTORY, [&](Item* item, InventoryScope /*scope*/)
+    {
+        VisualCandidate candidate{ item->GetEntry(), uint32(candidates.size()), item, 0, nullptr };
+        if (characterState != nullptr)
         {
-            const ItemUpgradeInfo &itemUpgradeInfo = upgradeInfo[i];
-            if (itemUpgradeInfo.upgrades.size() > highestStatUpgrade->upgrades.size())
-                highestStatUpgrade = &itemUpgradeInfo;
-            if (itemUpgradeInfo.weaponUpgrade != nullptr && (highestWeaponUpgrade->weaponUpgrade == nullptr || itemUpgradeInfo.weaponUpgrade->statModPct > highestWeaponUpgrade->weaponUpgrade->statModPct)) {
-                highestWeaponUpgrade = &itemUpgradeInfo;
+            ItemUpgradeContainer::const_iterator citer = characterState->items.find(item->GetGUID().GetCounter());
+            if (citer != characterState->items.end())
+            {
+                candidate.statCount = citer->second.statCount;
+                candidate.weaponUpgrade = citer->second.weaponUpgrade;
             }
         }
-        if (emptyUpgrade(highestStatUpgrade) && emptyUpgrade(highestWeaponUpgrade))
-            return &upgradeInfo[0];
+        candidates.push_back(candidate);
+    });
+
+    // grouped by entry, visiting order kept inside a group so ties go to the first item found as before
+    std::sort(candidates.begin(), candidates.end(), [](const VisualCandidate& a, const VisualCandidate& b)
+    {
+        return a.entry != b.entry ? a.entry < b.entry : a.order < b.order;
+    });
+
+    std::vector<Item*> visualItems;
+    for (std::size_t first = 0; first < candidates.size();)
+    {
+        const VisualCandidate* highestStatUpgrade = &candidates[first];
+        const VisualCandidate* highestWeaponUpgrade = &candidates[first];
+        std::size_t next = first + 1;
+        for (; next < candidates.size() && candidates[next].entry == candidates[first].entry; next++)
+        {
+            const VisualCandidate& candidate = candidates[next];
+            if (candidate.statCount > highestStatUpgrade->statCount)
+                highestStatUpgrade = &candidate;
+            if (candidate.weaponUpgrade != nullptr && (highestWeaponUpgrade->weaponUpgrade == nullptr || candidate.weaponUpgrade->statModPct > highestWeaponUpgrade->weaponUpgrade->statModPct))
+                highestWeaponUpgrade = &candidate;
+        }
 
+        bool hasStatUpgrade = highestStatUpgrade->statCount > 0;
+        bool hasWeaponUpgrade = highestWeaponUpgrade->weaponUpgrade != nullptr;
+        const VisualCandidate* chosen = &candidates[first];
         if (GetItemVisualsPriority() == PRIORITIZE_STATS)
         {
-            if (!highestStatUpgrade->upgrades.empty())
-                return highestStatUpgrade;
-            else
-                if (highestWeaponUpgrade->weaponUpgrade != nullptr)
-                    return highestWeaponUpgrade;
+            if (hasStatUpgrade)
+                chosen = highestStatUpgrade;
+            else if (hasWeaponUpgrade)
+                chosen = highestWeaponUpgrade;
         }
         else
         {
-            if (highestWeaponUpgrade->weaponUpgrade != nullptr)
-                return highestWeaponUpgrade;
-            else
-            {
-                if (!highestStatUpgrade->upgrades.empty())
-                    return highestStatUpgrade;
-            }
+            if (hasWeaponUpgrade)
+                chosen = highestWeaponUpgrade;
+            else if (hasStatUpgrade)
+                chosen = highestStatUpgrade;
         }
 
-        return &upgradeInfo[0];
-    };
-
-    for (const auto& p : entryUpgradeMap)
-    {
-        const ItemUpgradeInfo* itemUpgradeInfo = chooseVisualItem(p.first);
-        ASSERT(itemUpgradeInfo != nullptr);
-        Item* item = player->GetItemByGuid(itemUpgradeInfo->itemGuid);
-        if (item != nullptr)
-            SendItemPacket(player, item);
+        visualItems.push_back(chosen->item);
+        first = next;
     }
+
+    return visualItems;
 }
 
 void ItemUpgrade::VisualFeedback(Player* player)
@@ -2888,6 +4034,30 @@ void ItemUpgrade::VisualFeedback(Player* player)
     player->CastSpell(player, VISUAL_FEEDBACK_SPELL_ID, true);
 }
 
+std::pair<uint32, uint32> ItemUpgrade::GetItemLevel(const Player* player, Item* item) const
+{
+    const ItemTemplate* proto = item->GetTemplate();
+    return std::make_pair(proto->ItemLevel, GetItemLevel(proto, item, FindItemUpgradeState(player, item), FindPendingModifierSources(player)));
+}
+
+uint32 ItemUpgrade::GetItemLevel(const ItemTemplate* proto, const Item* item, const ItemUpgradeState* state, const ModifierSources* pendingSources) const
+{
+    if (state == nullptr || state->statCount == 0)
+        return proto->ItemLevel;
+
+    uint32 generation = itemLevelGeneration.load();
+    if (state->itemLevelGeneration != generation)
+    {
+        state->itemLevel = ItemUpgradeEngine::CalculateItemLevel(proto->ItemLevel, LoadItemStatInfo(proto, item), [&](const _ItemStat& stat)
+        {
+            return ModifyStat(proto->ItemId, state, pendingSources, stat.ItemStatType, stat.ItemStatValue);
+        });
+        state->itemLevelGeneration = generation;
+    }
+
+    return state->itemLevel;
+}
+
 std::pair<uint32, uint32> ItemUpgrade::CalculateItemLevel(const Player* player, Item* item, const UpgradeStat* upgrade) const
 {
     std::unordered_map<uint32, const UpgradeStat*> upgrades;
@@ -2899,25 +4069,15 @@ std::pair<uint32, uint32> ItemUpgrade::CalculateItemLevel(const Player* player,
 std::pair<uint32, uint32> ItemUpgrade::CalculateItemLevel(const Player* player, Item* item, std::unordered_map<uint32, const UpgradeStat*> upgrades) const
 {
     const ItemTemplate* proto = item->GetTemplate();
-    std::vector<_ItemStat> originalStats = LoadItemStatInfo(item);
-    if (originalStats.empty())
-        return std::make_pair(proto->ItemLevel, proto->ItemLevel);
-
-    uint32 originalSum = std::accumulate(originalStats.begin(), originalStats.end(), 0, [&](uint32 a, const _ItemStat& stat) { return a + stat.ItemStatValue; });
-    uint32 upgradedSum = 0;
-
-    for (const _ItemStat& stat : originalStats)
+    uint32 itemLevel = ItemUpgradeEngine::CalculateItemLevel(proto->ItemLevel, LoadItemStatInfo(item), [&](const _ItemStat& stat)
     {
-        if (upgrades.find(stat.ItemStatType) != upgrades.end())
-            upgradedSum += (uint32)CalculateModPct(stat.ItemStatValue, upgrades.at(stat.ItemStatType));
-        else
-            upgradedSum += HandleStatModifier(player, item, stat.ItemStatType, stat.ItemStatValue, MAX_ENCHANTMENT_SLOT);
-    }
-
-    if (upgradedSum <= originalSum)
-        return std::make_pair(proto->ItemLevel, proto->ItemLevel);
+        std::unordered_map<uint32, const UpgradeStat*>::const_iterator citer = upgrades.find(stat.ItemStatType);
+        if (citer != upgrades.end())
+            return CalculateModPct(stat.ItemStatValue, citer->second);
+        return HandleStatModifier(player, item, stat.ItemStatType, stat.ItemStatValue, MAX_ENCHANTMENT_SLOT);
+    });
 
-    return std::make_pair(proto->ItemLevel, (upgradedSum * proto->ItemLevel) / originalSum);
+    return std::make_pair(proto->ItemLevel, itemLevel);
 }
 
 bool ItemUpgrade::TryAddItem(Player* player, uint32 entry, uint32 count, bool add)
@@ -2959,7 +4119,7 @@ bool ItemUpgrade::PurgeUpgrade(Player* player, Item* item)
         if (item->IsEquipped())
             player->_ApplyItemMods(item, item->GetSlot(), false);
 
-        RemoveItemUpgrade(player, item);
+        RemoveItemUpgrade(player, item, nullptr);
 
         if (item->IsEquipped())
             player->_ApplyItemMods(item, item->GetSlot(), true);
@@ -2988,14 +4148,14 @@ bool ItemUpgrade::PurgeWeaponUpgrade(Player* player, Item* item)
         }
         std::unordered_map<uint32, StatRequirementContainer> statRequirementMap;
         statRequirementMap[0] = allReqs;
-        MergeStatRequirements(statRequirementMap, false);
+        MergeStatRequirements(statRequirementMap);
         if (!TryRefundRequirements(player, statRequirementMap.at(0)))
             return false;
 
         if (item->IsEquipped())
             player->_ApplyItemMods(item, item->GetSlot(), false);
 
-        RemoveWeaponUpgrade(player, item);
+        RemoveWeaponUpgrade(player, item, nullptr);
 
         if (item->IsEquipped())
             player->_ApplyItemMods(item, item->GetSlot(), true);
@@ -3015,14 +4175,14 @@ bool ItemUpgrade::TryRefundRequirements(Player* player, const StatRequirementCon
         switch (r.reqType)
         {
             case REQ_TYPE_COPPER:
-                if (player->GetMoney() + (uint32)r.reqVal1 > MAX_MONEY_AMOUNT)
+                if (player->GetMoney() + r.copper > MAX_MONEY_AMOUNT)
                 {
                     SendMessage(player, "Can't refund copper, would be at gold limit.");
                     return false;
                 }
                 break;
             case REQ_TYPE_ITEM:
-                if (!TryAddItem(player, (uint32)r.reqVal1, (uint32)r.reqVal2, false))
+                if (!TryAddItem(player, r.itemEntry, r.itemCount, false))
                     return false;
                 break;
         }
@@ -3033,16 +4193,16 @@ bool ItemUpgrade::TryRefundRequirements(Player* player, const StatRequirementCon
         switch (r.reqType)
         {
             case REQ_TYPE_COPPER:
-                player->ModifyMoney((int32)r.reqVal1);
+                player->ModifyMoney(int32(r.copper));
                 break;
             case REQ_TYPE_HONOR:
-                player->ModifyHonorPoints((int32)r.reqVal1);
+                player->ModifyHonorPoints(int32(r.points));
                 break;
             case REQ_TYPE_ARENA:
-                player->ModifyArenaPoints((int32)r.reqVal1);
+                player->ModifyArenaPoints(int32(r.points));
                 break;
             case REQ_TYPE_ITEM:
-                TryAddItem(player, (uint32)r.reqVal1, (uint32)r.reqVal2, true);
+                TryAddItem(player, r.itemEntry, r.itemCount, true);
                 break;
         }
     }
@@ -3073,23 +4233,29 @@ bool ItemUpgrade::RefundEverything(Player* player, Item* item, const std::vector
 
 bool ItemUpgrade::ChooseRandomUpgrade(Player* player, Item* item)
 {
+    ItemUpgradeProfileScope profile(PROFILE_RANDOM_UPGRADE);
+
     if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_ENABLED))
         return false;
 
+    if (!IsCharacterUpgradeDataLoaded(player))
+        return false;
+
     if (!GetBoolConfig(CONFIG_ITEM_UPGRADE_RANDOM_UPGRADES))
         return false;
 
     if (!IsAllowedItem(item) || IsBlacklistedItem(item))
         return false;
 
-    if (!FindUpgradesForItem(player, item).empty())
-        return false;
+    if (const ItemUpgradeState* state = FindItemUpgradeState(player, item))
+        if (state->statCount > 0)
+            return false;
 
     if (!roll_chance_f(GetFloatConfig(CONFIG_ITEM_UPGRADE_RANDOM_UPGRADES_CHANCE)))
         return false;
 
     uint32 statCountToUpgrade = urand(1, (uint32)GetIntConfig(CONFIG_ITEM_UPGRADE_RANDOM_UPGRADES_MAX_STATS));
-    std::vector<_ItemStat> statTypes = LoadItemStatInfo(item);
+    ItemStatInfo statTypes = LoadItemStatInfo(item);
     std::vector<const UpgradeStat*> upgrades;
     for (const _ItemStat& stat : statTypes)
     {
@@ -3106,36 +4272,37 @@ bool ItemUpgrade::ChooseRandomUpgrade(Player* player, Item* item)
 
     Acore::Containers::RandomShuffle(upgrades);
     uint32 currentStatCount = 0;
+    CharacterDatabaseTransaction trans = BeginUpgradeTransaction(player, std::min<std::size_t>(statCountToUpgrade, upgrades.size()));
     for (const UpgradeStat* stat : upgrades)
     {
         if (currentStatCount == statCountToUpgrade)
             break;
 
-        AddUpgradeForNewItem(player, item, stat, GetStatByType(statTypes, stat->statType));
+        AddUpgradeForNewItem(player, item, stat, GetStatByType(statTypes, stat->statType), trans);
 
         currentStatCount++;
     }
+    CommitUpgradeTransaction(trans);
 
     return true;
 }
 
-bool ItemUpgrade::AddUpgradeForNewItem(Player* player, Item* item, const UpgradeStat* upgrade, const _ItemStat* stat)
+bool ItemUpgrade::AddUpgradeForNewItem(Player* player, Item* item, const UpgradeStat* upgrade, const _ItemStat* stat, CharacterDatabaseTransaction trans)
 {
     if (stat == nullptr)
         return false;
 
+    if (upgrade->statType >= MAX_ITEM_MOD)
+        return false;
+
     const UpgradeStat* foundUpgrade = FindUpgradeForItem(player, item, upgrade->statType);
-    std::vector<CharacterUpgrade>& upgrades = characterUpgradeData[player->GetGUID().GetCounter()];
     if (foundUpgrade != nullptr)
         return false;
-    else
-        AddItemUpgradeToDB(player, item, upgrade);
+    else if (!JournalItemUpgrade(player, item))
+        AddItemUpgradeToDB(player, item, upgrade, trans);
 
-    CharacterUpgrade newUpgrade;
-    newUpgrade.guid = player->GetGUID().GetCounter();
-    newUpgrade.itemGuid = item->GetGUID();
-    newUpgrade.upgradeStat = upgrade;
-    upgrades.push_back(newUpgrade);
+    SetItemUpgradeStat(GetOrCreateItemUpgradeState(player, item), upgrade);
+    CountMetric(METRIC_COUNTER_RANDOM_UPGRADES);
 
     std::ostringstream oss;
     oss << "|cffeb891a[ITEM UPGRADES SYSTEM]:|r";
@@ -3143,7 +4310,7 @@ bool ItemUpgrade::AddUpgradeForNewItem(Player* player, Item* item, const Upgrade
     oss << " had " << StatTypeToString(upgrade->statType) << " upgraded to RANK " << upgrade->statRank << ".";
     oss << " Increase by " << upgrade->statModPct << "% [";
     oss << stat->ItemStatValue << " --> " << CalculateModPct(stat->ItemStatValue, upgrade) << "]";
-    std::pair<uint32, uint32> itemLevel = CalculateItemLevel(player, item);
+    std::pair<uint32, uint32> itemLevel = GetItemLevel(player, item);
     oss << " [New ILVL: " << itemLevel.second << "]";
     SendMessage(player, oss.str());
 
@@ -3152,14 +4319,25 @@ bool ItemUpgrade::AddUpgradeForNewItem(Player* player, Item* item, const Upgrade
     return true;
 }
 
-void ItemUpgrade::AddItemUpgradeToDB(const Player* player, const Item* item, const UpgradeStat* upgrade) const
+void ItemUpgrade::AddItemUpgradeToDB(const Player* player, const Item* item, const UpgradeStat* upgrade, CharacterDatabaseTransaction trans) const
 {
-    CharacterDatabase.Execute("INSERT INTO character_item_upgrade (guid, item_guid, stat_id) VALUES ({}, {}, {})",
-        player->GetGUID().GetCounter(), item->GetGUID().GetCounter(), upgrade->statId);
+    ExecuteUpgradeWrite(trans, Acore::StringFormat("INSERT INTO character_item_upgrade (guid, item_guid, stat_id) VALUES ({}, {}, {})",
+        player->GetGUID().GetCounter(), item->GetGUID().GetCounter(), upgrade->statId));
+}
+
+void ItemUpgrade::ExecuteUpgradeWrite(CharacterDatabaseTransaction trans, const std::string& sql) const
+{
+    if (trans)
+        trans->Append(sql);
+    else
+        CharacterDatabase.Execute(sql);
+
+    CountMetric(METRIC_COUNTER_DB_WRITES);
 }
 
 const ItemUpgrade::UpgradeStat* ItemUpgrade::FindNearestUpgradeStat(uint32 statType, uint16 rank, const Item* item) const
 {
+    rank = std::min(rank, GetMaxStatRank(statType));
     while (rank > 0)
     {
         const UpgradeStat* foundStat = FindUpgradeStat(statType, rank);
@@ -3174,20 +4352,30 @@ const ItemUpgrade::UpgradeStat* ItemUpgrade::FindNearestUpgradeStat(uint32 statT
 
 bool ItemUpgrade::IsAllowedStatForItem(const Item* item, const UpgradeStat* upgrade) const
 {
-    if (allowedStatItems.find(upgrade->statId) == allowedStatItems.end())
+    return GetDefinitions().IsAllowedStatForItem(item->GetEntry(), upgrade);
+}
+
+bool ItemUpgrade::UpgradeDefinitions::IsAllowedStatForItem(uint32 entry, const UpgradeStat* upgrade) const
+{
+    StatWithItemContainer::const_iterator citer = allowedStatItems.find(upgrade->statId);
+    if (citer == allowedStatItems.end())
         return true;
 
-    const std::set<uint32>& allowedStatsForItems = allowedStatItems.at(upgrade->statId);
-    return allowedStatsForItems.find(item->GetEntry()) != allowedStatsForItems.end();
+    return citer->second.find(entry) != citer->second.end();
 }
 
 bool ItemUpgrade::IsBlacklistedStatForItem(const Item* item, const UpgradeStat* upgrade) const
 {
-    if (blacklistedStatItems.find(upgrade->statId) == blacklistedStatItems.end())
+    return GetDefinitions().IsBlacklistedStatForItem(item->GetEntry(), upgrade);
+}
+
+bool ItemUpgrade::UpgradeDefinitions::IsBlacklistedStatForItem(uint32 entry, const UpgradeStat* upgrade) const
+{
+    StatWithItemContainer::const_iterator citer = blacklistedStatItems.find(upgrade->statId);
+    if (citer == blacklistedStatItems.end())
         return false;
 
-    const std::set<uint32>& blacklistedStatsForItems = blacklistedStatItems.at(upgrade->statId);
-    return blacklistedStatsForItems.find(item->GetEntry()) != blacklistedStatsForItems.end();
+    return citer->second.find(entry) != citer->second.end();
 }
 
 bool ItemUpgrade::CanApplyUpgradeForItem(const Item* item, const UpgradeStat* upgrade) const
@@ -3195,8 +4383,9 @@ bool ItemUpgrade::CanApplyUpgradeForItem(const Item* item, const UpgradeStat* up
     return IsAllowedStatForItem(item, upgrade) && !IsBlacklistedStatForItem(item, upgrade);
 }
 
-bool ItemUpgrade::CheckDataValidity() const
+bool ItemUpgrade::CheckDataValidity(const UpgradeDefinitions& newDefinitions) const
 {
+    const UpgradeStatContainer& upgradeStatList = newDefinitions.upgradeStatList;
     if (upgradeStatList.empty())
         return true;
 
@@ -3253,6 +4442,8 @@ bool ItemUpgrade::CheckDataValidity() const
 
 const ItemUpgrade::StatRequirementContainer* ItemUpgrade::GetStatRequirements(const UpgradeStat* upgrade, const Item* item) const
 {
+    const UpgradeDefinitions& currentDefinitions = GetDefinitions();
+    const auto& overrideStatRequirements = currentDefinitions.overrideStatRequirements;
     if (overrideStatRequirements.find(item->GetEntry()) != overrideStatRequirements.end())
     {
         const std::unordered_map<uint32, StatRequirementContainer>& itemReqs = overrideStatRequirements.at(item->GetEntry());
@@ -3260,6 +4451,7 @@ const ItemUpgrade::StatRequirementContainer* ItemUpgrade::GetStatRequirements(co
             return &itemReqs.at(upgrade->statId);
     }
 
+    const auto& baseStatRequirements = currentDefinitions.baseStatRequirements;
     if (baseStatRequirements.find(upgrade->statId) != baseStatRequirements.end())
         return &baseStatRequirements.at(upgrade->statId);
 
@@ -3295,7 +4487,26 @@ void ItemUpgrade::EquipItem(Player* player, Item* item)
 
 void ItemUpgrade::LoadWeaponUpgradePercents(const std::string& percents)
 {
-    weaponUpgradeStats.clear();
+    weaponUpgradeStats = ParseWeaponUpgradePercents(percents);
+
+    VisitCharacterUpgradeStates([&](CharacterUpgradeState& characterState)
+    {
+        for (auto& statePair : characterState.items)
+        {
+            ItemUpgradeState& state = statePair.second;
+            if (state.weaponUpgrade == nullptr && state.weaponUpgradeModPct == 0.0f)
+                continue;
+
+            state.weaponUpgrade = FindWeaponUpgradeStat(state.weaponUpgradeModPct);
+            if (state.weaponUpgrade == nullptr)
+                state.weaponUpgrade = FindNearestWeaponUpgradeStat(state.weaponUpgradeModPct);
+        }
+    });
+}
+
+/*static*/ ItemUpgrade::UpgradeStatContainer ItemUpgrade::ParseWeaponUpgradePercents(const std::string& percents)
+{
+    UpgradeStatContainer upgradeStats;
 
     std::vector<float> weaponUpgradePercents;
     std::vector<std::string_view> tokenized = Acore::Tokenize(percents, ',', false);
@@ -3311,19 +4522,10 @@ void ItemUpgrade::LoadWeaponUpgradePercents(const std::string& percents)
         weaponUpgradeStat.statRank = i + 1;
         weaponUpgradeStat.statModPct = weaponUpgradePercents[i];
         weaponUpgradeStat.statType = 0;
-        weaponUpgradeStats.push_back(weaponUpgradeStat);
+        upgradeStats.push_back(weaponUpgradeStat);
     }
 
-    for (auto itr = characterWeaponUpgradeData.begin(); itr != characterWeaponUpgradeData.end(); ++itr)
-    {
-        std::vector<CharacterUpgrade>& weaponUpgrades = itr->second;
-        for (CharacterUpgrade& upgrade : weaponUpgrades)
-        {
-            upgrade.upgradeStat = FindWeaponUpgradeStat(upgrade.upgradeStatModPct);
-            if (upgrade.upgradeStat == nullptr)
-                upgrade.upgradeStat = FindNearestWeaponUpgradeStat(upgrade.upgradeStatModPct);
-        }
-    }
+    return upgradeStats;
 }
 
 /*static*/ std::pair<float, float> ItemUpgrade::GetItemProtoDamage(const ItemTemplate* proto)
@@ -3348,19 +4550,13 @@ void ItemUpgrade::BuildWeaponUpgradeReqs()
     const ItemTemplate* tokenProto = sObjectMgr->GetItemTemplate(GetIntConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_TOKEN));
     if (tokenProto != nullptr)
     {
-        UpgradeStatReq tokenReq;
-        tokenReq.reqType = REQ_TYPE_ITEM;
-        tokenReq.reqVal1 = (float)GetIntConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_TOKEN);
-        tokenReq.reqVal2 = (float)GetIntConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_TOKEN_COUNT);
-        weaponUpgradeReqs.push_back(tokenReq);
+        weaponUpgradeReqs.push_back(UpgradeStatReq::Items(0, (uint32)GetIntConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_TOKEN),
+            (uint32)GetIntConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_TOKEN_COUNT)));
     }
 
     if (GetIntConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_MONEY) > 0)
     {
-        UpgradeStatReq moneyReq;
-        moneyReq.reqType = REQ_TYPE_COPPER;
-        moneyReq.reqVal1 = (float)GetIntConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_MONEY);
-        weaponUpgradeReqs.push_back(moneyReq);
+        weaponUpgradeReqs.push_back(UpgradeStatReq::Copper(0, (uint64)GetIntConfig(CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_MONEY)));
     }
 }
 
@@ -6,11 +6,23 @@
 #define _ITEM_UPGRADE_H_
 
 #include <vector>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include "Bag.h"
+#include "DatabaseEnvFwd.h"
 #include "GossipDef.h"
 #include "Player.h"
 #include "item_upgrade_config.h"
+#include "item_upgrade_engine.h"
 
-class ItemUpgrade
+class ItemUpgrade : public ItemUpgradeEngine
 {
 private:
     ItemUpgrade();
@@ -84,7 +96,6 @@ public:
         }
     };
 
-    struct UpgradeStat;
     struct PagedData
     {
         static constexpr int PAGE_SIZE = 12;
@@ -106,92 +117,385 @@ public:
         bool IsEmpty() const;
         const Identifier* FindIdentifierById(uint32 id) const;
     };
-    typedef std::unordered_map<uint32, PagedData> PagedDataMap;
 
-    enum UpgradeStatReqType
+    /* Indexed by statId */
+    typedef std::vector<const UpgradeStat*> UpgradeStatIndex;
+    /* Indexed by statType, then by statRank - 1 */
+    typedef std::array<UpgradeStatRanks, MAX_ITEM_MOD> UpgradeStatRankIndex;
+
+    struct ItemUpgradeState
     {
-        REQ_TYPE_COPPER = 1,
-        REQ_TYPE_HONOR,
-        REQ_TYPE_ARENA,
-        REQ_TYPE_ITEM,
-        REQ_TYPE_NONE,
-        MAX_REQ_TYPE
+        /* Last known position of the item (Item::GetPos), checked first and refreshed whenever the item has moved since */
+        uint16 pos;
+
+        /* Purchased stat ranks, indexed by ItemModType, nullptr for slots that are not upgraded */
+        std::array<const UpgradeStat*, MAX_ITEM_MOD> stats;
+        uint8 statCount;
+
+        /* Weapon damage upgrade, upgradeStatModPct keeps the percent stored in DB so it survives config reloads */
+        const UpgradeStat* weaponUpgrade;
+        float weaponUpgradeModPct;
+
+        /* Effective item level cached by GetItemLevel, only valid while itemLevelGeneration matches ItemUpgrade::itemLevelGeneration */
+        mutable uint32 itemLevel;
+        mutable uint32 itemLevelGeneration;
+
+        ItemUpgradeState() : pos(NULL_SLOT), statCount(0), weaponUpgrade(nullptr), weaponUpgradeModPct(0.0f), itemLevel(0), itemLevelGeneration(0)
+        {
+            stats.fill(nullptr);
+        }
+
+        void InvalidateItemLevel()
+        {
+            itemLevelGeneration = 0;
+        }
+
+        bool IsEmpty() const
+        {
+            return statCount == 0 && weaponUpgrade == nullptr && weaponUpgradeModPct == 0.0f;
+        }
     };
+    /* Keyed by item GUID (low part) */
+    typedef std::unordered_map<ObjectGuid::LowType, ItemUpgradeState> ItemUpgradeContainer;
 
-    struct UpgradeStatReq
+    struct PersistedItemUpgrade
     {
-        /* Associated stat ID from UpgradeStat */
-        uint32 statId;
+        /* statId stored in character_item_upgrade for each stat type, 0 when there is no row */
+        std::array<uint32, MAX_ITEM_MOD> statIds;
 
-        /*
-            Possible values:
-                1 = this rank requires money (copper, gold) to be bought
-                2 = this rank requires honor points to be bought
-                3 = this rank requires arena points to be bought
-                4 = this rank requires certain item(s) to be bought
-         */
-        UpgradeStatReqType reqType;
+        /* upgrade_perc stored in character_weapon_upgrade, 0 when there is no row */
+        float weaponUpgradeModPct;
+
+        PersistedItemUpgrade() : weaponUpgradeModPct(0.0f)
+        {
+            statIds.fill(0);
+        }
+    };
+
+    /*
+     * Everything the module keeps for an online character. It is owned by the Player (Object::CustomData), created
+     * at login and destroyed with it, so it is only touched by whoever updates the player: its map thread, or the
+     * world thread while maps are not being updated (sessions, commands, reloads). Stat hooks reach it straight from
+     * the Player without any lock, see ItemUpgrade::FindCharacterUpgradeState.
+     */
+    struct CharacterUpgradeState : public DataMap::Base
+    {
+        /* Owner character GUID (low part) */
+        uint32 guid;
+
+        /* Set once the async queries issued at login have been processed */
+        bool itemUpgradesLoaded;
+        bool weaponUpgradesLoaded;
+        bool clientEntriesLoaded;
+
+        /* Every upgraded item of this character */
+        ItemUpgradeContainer items;
+
+        /* Write-behind journal: what is persisted in DB for every item changed since the last flush, keyed by item GUID (low part) */
+        std::unordered_map<ObjectGuid::LowType, PersistedItemUpgrade> journal;
+
+        /* Item entry -> ItemQueryValues signature of the last item query response sent to this session */
+        std::unordered_map<uint32, uint64> sentItemQueries;
 
         /*
-         *   If reqType = 1 THEN required copper to purchase rank
-         *   If reqType = 2 THEN required honor points to purchase rank
-         *   If reqType = 3 THEN required arena points to purchase rank
-         *   If reqType = 4 THEN item ENTRY (from item_template.entry) required to purchase rank
+         * Item entries whose last response sent to this character was not the template (character_item_upgrade_sent).
+         * The client keeps its item cache across sessions, these are resent at login even when nothing differs now.
          */
-        float reqVal1;
+        std::unordered_set<uint32> upgradedClientEntries;
 
-        /*
-         *  If reqType = 4 THEN item count required to purchase rank
-         *  NOT USED otherwise
-         */ 
-        float reqVal2;
+        /* Bank item packets are deferred until the player first opens a banker in this session */
+        bool bankItemsSent;
+
+        /* Still in ModifierMigration::pendingPlayers, the hooks apply the previous modifier sources */
+        bool modifierMigrationPending;
+
+        /* Gossip menu state of the upgrade NPC */
+        PagedData pagedData;
+
+        explicit CharacterUpgradeState(uint32 guid) : guid(guid), itemUpgradesLoaded(false), weaponUpgradesLoaded(false), clientEntriesLoaded(false), bankItemsSent(false), modifierMigrationPending(false) {}
+        ~CharacterUpgradeState() override;
+
+        bool IsLoaded() const
+        {
+            return itemUpgradesLoaded && weaponUpgradesLoaded && clientEntriesLoaded;
+        }
+    };
+    /* Keyed by character GUID (low part), the states themselves are owned by their Player */
+    typedef std::unordered_map<uint32, CharacterUpgradeState*> CharacterUpgradeStateContainer;
+
+    /* Guards the structure of one shard of the registry, never taken from the stat hooks */
+    struct CharacterUpgradeStateShard
+    {
+        std::mutex lock;
+        CharacterUpgradeStateContainer states;
+    };
 
-        UpgradeStatReq()
+    /* Fields of the item query response that upgrades can change, everything else is sent as in the template */
+    struct ItemQueryValues
+    {
+        uint32 itemLevel;
+        std::array<int32, MAX_ITEM_PROTO_STATS> statValues;
+        std::array<std::pair<float, float>, MAX_ITEM_PROTO_DAMAGES> damages;
+
+        uint64 Signature() const;
+    };
+
+    struct ItemQueryCacheKey
+    {
+        uint32 entry;
+        int32 locale;
+        uint64 signature;
+
+        bool operator==(const ItemQueryCacheKey& other) const
         {
-            statId = 0;
-            reqType = MAX_REQ_TYPE;
-            reqVal1 = 0.0f;
-            reqVal2 = 0.0f;
+            return entry == other.entry && locale == other.locale && signature == other.signature;
         }
+    };
 
-        UpgradeStatReq(uint32 statId, UpgradeStatReqType reqType, float reqVal1, float reqVal2)
-            : statId(statId), reqType(reqType), reqVal1(reqVal1), reqVal2(reqVal2) {}
+    struct ItemQueryCacheKeyHash
+    {
+        std::size_t operator()(const ItemQueryCacheKey& key) const
+        {
+            return std::hash<uint64>()(key.signature ^ (uint64(key.entry) << 8) ^ uint64(uint32(key.locale)));
+        }
+    };
+    /* Most recently used first, shared so a packet can be sent after the lock is released even if it is evicted meanwhile */
+    typedef std::list<std::pair<ItemQueryCacheKey, std::shared_ptr<const WorldPacket>>> ItemQueryCacheList;
 
-        UpgradeStatReq(uint32 statId, UpgradeStatReqType reqType, float reqVal1)
-            : statId(statId), reqType(reqType), reqVal1(reqVal1), reqVal2(0.0f) {}
+    /* Receives the item query responses, the session of the player or nothing at all for the load generator */
+    typedef std::function<void(const WorldPacket*)> ItemPacketSink;
 
-        UpgradeStatReq(uint32 statId, UpgradeStatReqType reqType)
-            : statId(statId), reqType(reqType), reqVal1(0.0f), reqVal2(0.0f) {}
+    /* Item query response serialized from the template, with the position of every field ItemQueryValues patches */
+    struct ItemQueryTemplate
+    {
+        WorldPacket packet;
+        std::size_t itemLevelPos;
+        std::array<std::size_t, MAX_ITEM_PROTO_STATS> statValuePos;
+        std::array<std::pair<std::size_t, std::size_t>, MAX_ITEM_PROTO_DAMAGES> damagePos;
     };
-    typedef std::vector<UpgradeStatReq> StatRequirementContainer;
+    /* Keyed by (item entry, session DB locale) */
+    typedef std::map<std::pair<uint32, int32>, ItemQueryTemplate> ItemQueryTemplateContainer;
 
-    struct UpgradeStat
+    /* Stats of an item instance as returned by LoadItemStatInfo, sized for every proto stat and every stat effect of the random property enchantments */
+    struct ItemStatInfo
     {
-        uint32 statId;
-        uint32 statType;
-        float statModPct;
-        uint16 statRank;
+        static constexpr std::size_t MAX_STATS = MAX_ITEM_PROTO_STATS + (MAX_ENCHANTMENT_SLOT - PROP_ENCHANTMENT_SLOT_0) * MAX_SPELL_ITEM_ENCHANTMENT_EFFECTS;
+
+        std::array<_ItemStat, MAX_STATS> stats;
+        uint8 count;
+
+        ItemStatInfo() : count(0) {}
+
+        void push_back(const _ItemStat& stat) { ASSERT(count < MAX_STATS); stats[count++] = stat; }
+        bool empty() const { return count == 0; }
+        std::size_t size() const { return count; }
+        const _ItemStat& operator[](std::size_t index) const { return stats[index]; }
+        const _ItemStat* begin() const { return stats.data(); }
+        const _ItemStat* end() const { return stats.data() + count; }
     };
-    typedef std::vector<UpgradeStat> UpgradeStatContainer;
 
-    struct CharacterUpgrade
+    /* Random property enchantments are fully determined by the random property id and suffix factor of the item */
+    struct ItemStatInfoKey
     {
-        uint32 guid;
-        ObjectGuid itemGuid;
-        const UpgradeStat* upgradeStat;
-        float upgradeStatModPct;
+        uint32 entry;
+        int32 randomPropertyId;
+        uint32 suffixFactor;
+
+        bool operator==(const ItemStatInfoKey& other) const
+        {
+            return entry == other.entry && randomPropertyId == other.randomPropertyId && suffixFactor == other.suffixFactor;
+        }
+    };
+
+    struct ItemStatInfoKeyHash
+    {
+        std::size_t operator()(const ItemStatInfoKey& key) const
+        {
+            return std::hash<uint64>()((uint64(key.entry) << 32) ^ (uint64(uint32(key.randomPropertyId)) << 16) ^ uint64(key.suffixFactor));
+        }
     };
-    typedef std::unordered_map<uint32, std::vector<CharacterUpgrade>> CharacterUpgradeContainer;
+    /* Most recently used first */
+    typedef std::list<std::pair<ItemStatInfoKey, ItemStatInfo>> ItemStatInfoCacheList;
 
-    struct ItemUpgradeInfo
+    enum InventoryScope : uint8
     {
+        INVENTORY_SCOPE_NONE        = 0x00,
+        INVENTORY_SCOPE_BACKPACK    = 0x01,
+        INVENTORY_SCOPE_BAGS        = 0x02,
+        INVENTORY_SCOPE_EQUIPPED    = 0x04,
+        INVENTORY_SCOPE_BANK        = 0x08,
+        INVENTORY_SCOPE_BANK_BAGS   = 0x10,
+
+        INVENTORY_SCOPE_INVENTORY   = INVENTORY_SCOPE_BACKPACK | INVENTORY_SCOPE_BAGS | INVENTORY_SCOPE_EQUIPPED,
+        INVENTORY_SCOPE_ALL         = INVENTORY_SCOPE_INVENTORY | INVENTORY_SCOPE_BANK | INVENTORY_SCOPE_BANK_BAGS
+    };
+
+    enum ItemPacketPriority
+    {
+        ITEM_PACKET_PRIORITY_EQUIPPED,
+        ITEM_PACKET_PRIORITY_BAGS,
+        ITEM_PACKET_PRIORITY_BANK,
+        MAX_ITEM_PACKET_PRIORITY
+    };
+
+    struct QueuedItemPacket
+    {
+        ObjectGuid playerGuid;
         ObjectGuid itemGuid;
-        std::vector<const UpgradeStat*> upgrades;
-        const UpgradeStat* weaponUpgrade;
+        /* getMSTime() when queued */
+        uint32 queueTime;
+    };
+
+    struct ItemPacketQueueStats
+    {
+        std::array<uint32, MAX_ITEM_PACKET_PRIORITY> depth;
+        uint64 sentPackets;
+        /* Milliseconds between queueing and sending, over every packet sent since startup */
+        uint32 averageLatency;
+        uint32 maxLatency;
+    };
+
+    /* One step of RunLoadTest, heapGrowth is signed since freeing phases shrink the heap */
+    struct LoadTestPhase
+    {
+        std::string name;
+        uint64 elapsedUs;
+        int64 heapGrowth;
+        /* Peak resident set size of the whole process once the phase is done, in KB */
+        uint64 peakRssKB;
+    };
+
+    struct LoadTestReport
+    {
+        uint32 characters;
+        uint32 items;
+        uint32 statUpgrades;
+        uint32 weaponUpgrades;
+        uint32 packets;
+        uint64 packetBytes;
+        /* False when the definitions could not be rebuilt, the reload phase is then missing */
+        bool reloaded;
+        std::vector<LoadTestPhase> phases;
+
+        LoadTestReport() : characters(0), items(0), statUpgrades(0), weaponUpgrades(0), packets(0), packetBytes(0), reloaded(false) {}
+    };
+
+    enum MetricCounter
+    {
+        METRIC_COUNTER_PURCHASES,
+        METRIC_COUNTER_RANDOM_UPGRADES,
+        METRIC_COUNTER_ITEM_PACKETS,
+        METRIC_COUNTER_DB_WRITES,
+        MAX_METRIC_COUNTERS
     };
 
     typedef std::set<uint32> ItemEntryContainer;
     typedef std::unordered_map<uint32, std::set<uint32>> StatWithItemContainer;
+
+    /* Static properties of an ItemTemplate, everything that does not depend on the item instance */
+    enum ItemTemplateFlags : uint8
+    {
+        ITEM_TEMPLATE_FLAG_HAS_STATS            = 0x01,
+        ITEM_TEMPLATE_FLAG_HEIRLOOM             = 0x02,
+        ITEM_TEMPLATE_FLAG_HAS_WEAPON_DAMAGE    = 0x04,
+        ITEM_TEMPLATE_FLAG_ALLOWED              = 0x08,
+        ITEM_TEMPLATE_FLAG_BLACKLISTED          = 0x10
+    };
+
+    /* Everything loaded from the mod_item_upgrade_* tables, never modified once published */
+    struct UpgradeDefinitions
+    {
+        UpgradeStatContainer upgradeStatList;
+        UpgradeStatIndex upgradeStatById;
+        UpgradeStatRankIndex upgradeStatsByType;
+        ItemEntryContainer allowedItems;
+        ItemEntryContainer blacklistedItems;
+        StatWithItemContainer allowedStatItems;
+        StatWithItemContainer blacklistedStatItems;
+
+        std::map<float, std::vector<const UpgradeStat*>> upgradesPctMap;
+
+        std::unordered_map<uint32, StatRequirementContainer> baseStatRequirements;
+        std::unordered_map<uint32, std::unordered_map<uint32, StatRequirementContainer>> overrideStatRequirements;
+
+        /* ItemTemplateFlags indexed by item entry, same layout as ObjectMgr::GetItemTemplateStoreFast */
+        std::vector<uint8> itemTemplateFlags;
+
+        const UpgradeStat* FindUpgradeStat(uint32 statId) const
+        {
+            return statId < upgradeStatById.size() ? upgradeStatById[statId] : nullptr;
+        }
+
+        uint8 GetItemTemplateFlags(const ItemTemplate* proto) const;
+
+        bool IsAllowedItem(uint32 entry) const;
+        bool IsBlacklistedItem(uint32 entry) const;
+        bool IsAllowedStatForItem(uint32 entry, const UpgradeStat* upgrade) const;
+        bool IsBlacklistedStatForItem(uint32 entry, const UpgradeStat* upgrade) const;
+    };
+
+    /* Everything the effective stat and weapon damage modifiers of an upgraded item depend on */
+    struct ModifierSources
+    {
+        const UpgradeDefinitions* definitions;
+        const std::vector<uint32>* allowedStats;
+        const UpgradeStatContainer* weaponUpgradeStats;
+        bool enabled;
+        bool weaponDamage;
+    };
+
+    /* Upgrade applied to each stat type and to weapon damage of an item, nullptr when not modified */
+    struct ItemModifiers
+    {
+        std::array<const UpgradeStat*, MAX_ITEM_MOD> stats;
+        const UpgradeStat* weaponUpgrade;
+
+        ItemModifiers() : weaponUpgrade(nullptr)
+        {
+            stats.fill(nullptr);
+        }
+
+        /* Upgrades may come from different snapshots, only what CalculateModPct uses is compared */
+        static bool SameModifier(const UpgradeStat* a, const UpgradeStat* b)
+        {
+            if (a == nullptr || b == nullptr)
+                return a == b;
+            return a->statModPct == b->statModPct && a->statRank == b->statRank;
+        }
+
+        bool operator==(const ItemModifiers& other) const
+        {
+            for (uint32 i = 0; i < MAX_ITEM_MOD; i++)
+                if (!SameModifier(stats[i], other.stats[i]))
+                    return false;
+            return SameModifier(weaponUpgrade, other.weaponUpgrade);
+        }
+    };
+
+    /*
+     * A reload that changed the modifier sources, re-applied to players a few at a time. Players still pending keep
+     * their modifiers computed from oldSources, so equipping and unequipping stays symmetric until they are migrated.
+     */
+    struct ModifierMigration
+    {
+        /* Set when the definitions were replaced, oldSources may point into it */
+        std::unique_ptr<const UpgradeDefinitions> oldDefinitions;
+        std::vector<uint32> oldAllowedStats;
+        UpgradeStatContainer oldWeaponUpgradeStats;
+        ModifierSources oldSources;
+
+        /* Character GUIDs (low part) not migrated yet */
+        std::unordered_set<uint32> pendingPlayers;
+        uint32 totalPlayers;
+
+        /* Progress, players and items counted only when their modifiers changed */
+        uint32 players;
+        uint32 items;
+        uint32 skippedItems;
+        uint32 startTime;
+
+        ModifierMigration() : totalPlayers(0), players(0), items(0), skippedItems(0), startTime(0) {}
+    };
 public:
     static ItemUpgrade* instance();
 
@@ -202,13 +506,73 @@ public:
         return citr != c.end() ? (T*)(&*citr) : nullptr;
     }
 
+    /*
+     * Calls visitor(Item*, InventoryScope) for every item of the player in the given scopes (InventoryScope flags),
+     * in backpack, bags, equipped, bank, bank bags order. Nothing is allocated, use this instead of collecting items first.
+     */
+    template <typename Visitor>
+    static void VisitPlayerItems(const Player* player, uint8 scopes, Visitor&& visitor)
+    {
+        if (scopes & INVENTORY_SCOPE_BACKPACK)
+            for (uint8 i = INVENTORY_SLOT_ITEM_START; i < INVENTORY_SLOT_ITEM_END; i++)
+                if (Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, i))
+                    visitor(item, INVENTORY_SCOPE_BACKPACK);
+
+        if (scopes & INVENTORY_SCOPE_BAGS)
+            VisitBagItems(player, INVENTORY_SLOT_BAG_START, INVENTORY_SLOT_BAG_END, INVENTORY_SCOPE_BAGS, visitor);
+
+        if (scopes & INVENTORY_SCOPE_EQUIPPED)
+            for (uint8 i = EQUIPMENT_SLOT_START; i < EQUIPMENT_SLOT_END; i++)
+                if (Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, i))
+                    visitor(item, INVENTORY_SCOPE_EQUIPPED);
+
+        if (scopes & INVENTORY_SCOPE_BANK)
+            for (uint8 i = BANK_SLOT_ITEM_START; i < BANK_SLOT_ITEM_END; i++)
+                if (Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, i))
+                    visitor(item, INVENTORY_SCOPE_BANK);
+
+        if (scopes & INVENTORY_SCOPE_BANK_BAGS)
+            VisitBagItems(player, BANK_SLOT_BAG_START, BANK_SLOT_BAG_END, INVENTORY_SCOPE_BANK_BAGS, visitor);
+    }
+    static std::string InventoryScopeToString(InventoryScope scope);
+    static InventoryScope GetInventoryScope(const Item* item);
+
+    /* Same as VisitPlayerItems but only for the upgraded items of the player, looked up from CharacterUpgradeState::items */
+    template <typename Visitor>
+    void VisitUpgradedItems(const Player* player, uint8 scopes, Visitor&& visitor)
+    {
+        CharacterUpgradeState* characterState = FindCharacterUpgradeState(player);
+        if (characterState == nullptr)
+            return;
+
+        for (auto& indexed : characterState->items)
+        {
+            Item* item = FindIndexedItem(player, indexed.first, indexed.second.pos);
+            if (item == nullptr)
+                continue;
+
+            InventoryScope scope = GetInventoryScope(item);
+            if (scope & scopes)
+                visitor(item, scope);
+        }
+    }
+
     bool GetBoolConfig(ItemUpgradeBoolConfigs index) const;
     std::string GetStringConfig(ItemUpgradeStringConfigs index) const;
     float GetFloatConfig(ItemUpgradeFloatConfigs index) const;
     int32 GetIntConfig(ItemUpgradeIntConfigs index) const;
 
     void LoadConfig(bool reload);
-    void LoadFromDB(bool reload = false);
+    void ReloadConfig();
+    void LoadFromDB();
+    bool StartDefinitionsReload();
+    bool IsDefinitionsReloadPending() const;
+    void UpdateDefinitionsReload();
+    void WaitForDefinitionsReload();
+
+    bool IsModifierMigrationPending() const;
+    std::pair<uint32, uint32> GetModifierMigrationProgress() const;
+    void UpdateModifierMigration();
 
     void BuildUpgradableItemCatalogue(const Player* player, PagedDataType type);
     void BuildStatsUpgradeCatalogue(const Player* player, const Item* item);
@@ -223,7 +587,6 @@ public:
     void BuildWeaponUpgradeInfoCatalogue(const Player* player, const Item* item);
 
     PagedData& GetPagedData(const Player* player);
-    PagedDataMap& GetPagedDataMap();
     bool AddPagedData(Player* player, Creature* creature, uint32 page);
     bool TakePagedDataAction(Player* player, Creature* creature, uint32 action);
 
@@ -237,12 +600,23 @@ public:
     void HandleItemRemove(Player* player, Item* item);
     void HandleCharacterRemove(uint32 guid);
 
+    void LoadCharacterUpgradeData(Player* player);
+    void UnloadCharacterUpgradeData(Player* player);
+    bool IsCharacterUpgradeDataLoaded(const Player* player) const;
+
+    void FlushUpgradeJournal(const Player* player);
+    void FlushUpgradeJournals();
+
     void SetReloading(bool value);
     bool GetReloading() const;
 
-    void HandleDataReload(bool apply);
-
-    void UpdateVisualCache(Player* player);
+    void UpdateVisualCache(Player* player, bool force = false);
+    void QueueVisualCacheUpdate(Player* player);
+    void QueueBankVisualCacheUpdate(Player* player);
+    void UpdateItemPacketQueue();
+    ItemPacketQueueStats GetItemPacketQueueStats() const;
+    void UpdateMetrics(uint32 diff);
+    LoadTestReport RunLoadTest(uint32 characters, uint32 itemsPerCharacter);
     void VisualFeedback(Player* player);
 
     bool ChooseRandomUpgrade(Player* player, Item* item);
@@ -251,17 +625,16 @@ public:
 
     static std::string StatTypeToString(uint32 statType);
     static std::string EquipmentSlotToString(EquipmentSlots slot);
-    static std::vector<_ItemStat> LoadItemStatInfo(const Item* item);
-    static const _ItemStat* GetStatByType(const std::vector<_ItemStat>& statInfo, uint32 statType);
+    ItemStatInfo LoadItemStatInfo(const Item* item) const;
+    /* item is nullptr for a template without instance, which has no random property stats */
+    ItemStatInfo LoadItemStatInfo(const ItemTemplate* proto, const Item* item) const;
+    static const _ItemStat* GetStatByType(const ItemStatInfo& statInfo, uint32 statType);
     static std::pair<float, float> GetItemProtoDamage(const ItemTemplate* proto);
     static std::pair<float, float> GetItemProtoDamage(const Item* item);
 
     static std::string FormatFloat(float val, uint32 decimals = 2);
     static std::string FormatIncrease(float prev, float next);
 
-    static int32 CalculateModPct(int32 value, const UpgradeStat* upgradeStat);
-    static float CalculateModPctF(float value, const UpgradeStat* upgradeStat);
-
     std::vector<const UpgradeStat*> FindUpgradesForItem(const Player* player, const Item* item) const;
     const UpgradeStat* FindUpgradeForWeapon(const Player* player, const Item* item) const;
 
@@ -281,44 +654,98 @@ private:
 
     bool reloading;
     std::vector<uint32> allowedStats;
-    UpgradeStatContainer upgradeStatList;
-    PagedDataMap playerPagedData;
-    CharacterUpgradeContainer characterUpgradeData;
-    ItemEntryContainer allowedItems;
-    ItemEntryContainer blacklistedItems;
-    StatWithItemContainer allowedStatItems;
-    StatWithItemContainer blacklistedStatItems;
-
-    std::map<float, std::vector<const ItemUpgrade::UpgradeStat*>> upgradesPctMap;
 
-    std::unordered_map<uint32, StatRequirementContainer> baseStatRequirements;
-    std::unordered_map<uint32, std::unordered_map<uint32, StatRequirementContainer>> overrideStatRequirements;
+    /* Online characters by GUID for the world thread (reloads, migration, shutdown), sharded by GUID */
+    static constexpr uint32 CHARACTER_UPGRADE_STATE_SHARDS = 16;
+    std::array<CharacterUpgradeStateShard, CHARACTER_UPGRADE_STATE_SHARDS> characterUpgradeStates;
+
+    /* Readers only go through the atomic pointer, the unique_ptr owns the published snapshot */
+    std::atomic<const UpgradeDefinitions*> definitions;
+    std::unique_ptr<const UpgradeDefinitions> publishedDefinitions;
+    /* Snapshot being built by a reload, empty (invalid) when no reload is in progress */
+    std::future<std::unique_ptr<const UpgradeDefinitions>> pendingDefinitions;
+    /* Players not re-applied yet after the last reload, nullptr when everyone is up to date */
+    std::unique_ptr<ModifierMigration> modifierMigration;
+    /* Set when .reload config came in during a migration */
+    bool configReloadDeferred;
+
+    /* Serialized item query responses shared by every session, item packets can be sent from map threads */
+    ItemQueryCacheList itemQueryCache;
+    std::unordered_map<ItemQueryCacheKey, ItemQueryCacheList::iterator, ItemQueryCacheKeyHash> itemQueryCacheIndex;
+    ItemQueryTemplateContainer itemQueryTemplates;
+
+    /* Realm wide pacing of login item packets, filled from map threads and drained by the world update */
+    std::array<std::deque<QueuedItemPacket>, MAX_ITEM_PACKET_PRIORITY> itemPacketQueue;
+    uint64 itemPacketQueueSent;
+    uint64 itemPacketQueueLatencySum;
+    uint32 itemPacketQueueMaxLatency;
+    mutable std::mutex itemPacketQueueLock;
+    std::mutex itemQueryCacheLock;
+
+    /* LoadItemStatInfo memo, used from map threads too */
+    mutable ItemStatInfoCacheList itemStatInfoCache;
+    mutable std::unordered_map<ItemStatInfoKey, ItemStatInfoCacheList::iterator, ItemStatInfoKeyHash> itemStatInfoCacheIndex;
+    mutable std::mutex itemStatInfoCacheLock;
+
+    /* Totals since startup, UpdateMetrics sends what changed since its previous sample */
+    mutable std::array<std::atomic<uint64>, MAX_METRIC_COUNTERS> metricCounters;
+    std::array<uint64, MAX_METRIC_COUNTERS> sampledMetricCounters;
+    uint32 metricsTimer;
+    uint32 reloadStartTime;
+
+    /* Bumped whenever definitions or config change, invalidating every cached ItemUpgradeState::itemLevel at once */
+    std::atomic<uint32> itemLevelGeneration;
 
     UpgradeStatContainer weaponUpgradeStats;
-    CharacterUpgradeContainer characterWeaponUpgradeData;
     StatRequirementContainer weaponUpgradeReqs;
 
     static bool CompareIdentifier(const Identifier* a, const Identifier* b);
-    static std::string CopperToMoneyStr(uint32 money, bool colored);
+    static std::string CopperToMoneyStr(uint64 money, bool colored);
     static std::string FormatItemLocation(const Player* player, const Item* item);
 
-    void CleanupDB(bool reload);
-    void LoadStatRequirements();
-    void LoadStatRequirementsOverrides();
-    void LoadUpgradeStats();
-    void LoadCharacterUpgradeData();
-    void LoadCharacterWeaponUpgradeData();
-    void LoadAllowedItems();
-    void LoadAllowedStatsItems();
-    void LoadBlacklistedItems();
-    void LoadBlacklistedStatsItems();
+    const UpgradeDefinitions& GetDefinitions() const;
+    /* Read from the world config, so only on the world thread; BuildDefinitions gets a copy */
+    RequirementLimits GetRequirementLimits() const;
+    std::unique_ptr<const UpgradeDefinitions> BuildDefinitions(const RequirementLimits& limits) const;
+    void PublishDefinitions(std::unique_ptr<const UpgradeDefinitions> newDefinitions);
+    ModifierSources GetModifierSources() const;
+    const ModifierSources* FindPendingModifierSources(const Player* player) const;
+    const ModifierSources* FindPendingModifierSources(const CharacterUpgradeState* characterState) const;
+    ItemModifiers GetItemModifiers(const Item* item, const ItemUpgradeState& state, const ModifierSources& sources) const;
+    ItemModifiers GetItemModifiers(uint32 entry, const ItemUpgradeState& state, const ModifierSources& sources) const;
+    void StartModifierMigration(const std::function<void()>& commit);
+    void ProcessModifierMigration(uint32 maxPlayers, uint32 maxMicroseconds);
+    void MigratePlayerModifiers(uint32 guid);
+    void FinishModifierMigration();
+    void CleanupDB(bool reload) const;
+    void LoadStatRequirements(UpgradeDefinitions& newDefinitions, const RequirementLimits& limits) const;
+    void LoadStatRequirementsOverrides(UpgradeDefinitions& newDefinitions, const RequirementLimits& limits) const;
+    void LoadUpgradeStats(UpgradeDefinitions& newDefinitions) const;
+    void LoadCharacterItemUpgrades(Player* player, QueryResult result);
+    void LoadCharacterWeaponUpgrades(Player* player, QueryResult result);
+    void LoadCharacterClientEntries(Player* player, QueryResult result);
+    void RemapItemUpgradeState(ItemUpgradeState& state);
+    bool IsWriteBehind(const Player* player) const;
+    bool JournalItemUpgrade(const Player* player, const Item* item);
+    void FlushUpgradeJournal(CharacterUpgradeState& characterState, CharacterDatabaseTransaction trans);
+    CharacterDatabaseTransaction BeginUpgradeTransaction(const Player* player, std::size_t writes) const;
+    void CommitUpgradeTransaction(CharacterDatabaseTransaction trans) const;
+    void LoadAllowedItems(UpgradeDefinitions& newDefinitions) const;
+    void LoadAllowedStatsItems(UpgradeDefinitions& newDefinitions) const;
+    void LoadBlacklistedItems(UpgradeDefinitions& newDefinitions) const;
+    void LoadBlacklistedStatsItems(UpgradeDefinitions& newDefinitions) const;
     bool IsValidReqType(uint8 reqType) const;
-    bool ValidateReq(uint32 id, UpgradeStatReqType reqType, float val1, float val2, const std::string& table) const;
+    bool ValidateReq(uint32 id, UpgradeStatReqType reqType, int64 val1, int64 val2, const std::string& table, const RequirementLimits& limits) const;
+    static UpgradeStatReq MakeStatReq(uint32 statId, UpgradeStatReqType reqType, int64 val1, int64 val2);
     void AddItemToPagedData(const Item* item, const Player* player, PagedData& pagedData);
     bool _AddPagedData(Player* player, const PagedData& pagedData, uint32 page) const;
+    int32 _HandleStatModifier(const Player* player, Item* item, uint32 statType, int32 amount, EnchantmentSlot slot) const;
+    /* What the stat and weapon damage hooks apply, pendingSources is set while the owner is not migrated yet after a reload */
+    int32 ModifyStat(uint32 entry, const ItemUpgradeState* state, const ModifierSources* pendingSources, uint32 statType, int32 amount) const;
+    std::pair<float, float> ModifyWeaponDamage(uint32 entry, const ItemUpgradeState* state, const ModifierSources* pendingSources, float minDamage, float maxDamage) const;
     void NoPagedData(Player* player, const PagedData& pagedData) const;
     std::string ItemLinkForUI(const Item* item, const Player* player) const;
-    void MergeStatRequirements(std::unordered_map<uint32, StatRequirementContainer>& statRequirementMap, bool validate = true);
+    void MergeStatRequirements(std::unordered_map<uint32, StatRequirementContainer>& statRequirementMap, const RequirementLimits* limits = nullptr) const;
 
     template <typename Func>
     const UpgradeStat* _FindUpgradeStat(const UpgradeStatContainer& upgradeStatContainer, Func f) const
@@ -331,10 +758,38 @@ private:
 
     const UpgradeStat* FindUpgradeStat(uint32 statId) const;
     const UpgradeStat* FindUpgradeStat(uint32 statType, uint16 rank) const;
+    uint16 GetMaxStatRank(uint32 statType) const;
     const UpgradeStat* FindWeaponUpgradeStat(float pct) const;
+    static const UpgradeStat* FindWeaponUpgradeStat(const UpgradeStatContainer& upgradeStats, float pct);
     const UpgradeStat* FindNearestWeaponUpgradeStat(float pct) const;
+    static const UpgradeStat* FindNearestWeaponUpgradeStat(const UpgradeStatContainer& upgradeStats, float pct);
     const UpgradeStat* FindNextWeaponUpgradeStat(float pct) const;
-    std::vector<const UpgradeStat*> _FindUpgradesForItem(const CharacterUpgradeContainer& characterUpgradeDataContainer, const Player* player, const Item* item) const;
+    static CharacterUpgradeState* FindCharacterUpgradeState(const Player* player);
+    static CharacterUpgradeState& GetCharacterUpgradeState(const Player* player);
+    CharacterUpgradeState* FindCharacterUpgradeState(uint32 guid);
+    CharacterUpgradeStateShard& GetCharacterUpgradeStateShard(uint32 guid);
+    void RegisterCharacterUpgradeState(CharacterUpgradeState* characterState);
+    void UnregisterCharacterUpgradeState(const CharacterUpgradeState* characterState);
+
+    /* World thread only, visits every online character while the registry shards are locked one by one */
+    template <typename Visitor>
+    void VisitCharacterUpgradeStates(Visitor&& visitor)
+    {
+        for (CharacterUpgradeStateShard& shard : characterUpgradeStates)
+        {
+            std::lock_guard<std::mutex> guard(shard.lock);
+            for (auto& statePair : shard.states)
+                visitor(*statePair.second);
+        }
+    }
+
+    const ItemUpgradeState* FindItemUpgradeState(const Player* player, const Item* item) const;
+    ItemUpgradeState* FindItemUpgradeState(const Player* player, const Item* item);
+    static const ItemUpgradeState* FindItemUpgradeState(const CharacterUpgradeState* characterState, const Item* item);
+    ItemUpgradeState& GetOrCreateItemUpgradeState(const Player* player, const Item* item);
+    ItemUpgradeState& GetOrCreateItemUpgradeState(const Player* player, ObjectGuid::LowType itemGuid);
+    void SetItemUpgradeStat(ItemUpgradeState& state, const UpgradeStat* upgrade);
+    void EraseItemUpgradeStateIfEmpty(const Player* player, const Item* item);
     const UpgradeStat* FindUpgradeForItem(const Player* player, const Item* item, uint32 statType) const;
     bool MeetsRequirement(const Player* player, const UpgradeStatReq& req) const;
     bool MeetsRequirement(const Player* player, const UpgradeStat* upgradeStat, const Item* item) const;
@@ -344,32 +799,66 @@ private:
     void TakeWeaponUpgradeRequirements(Player* player);
     bool PurchaseUpgrade(Player* player);
     bool PurchaseWeaponUpgrade(Player* player);
-    void AddUpgradedItemToPagedData(const Item* item, const Player* player, PagedData& pagedData, const std::string &from);
-    void HandleDataReload(Player* player, bool apply);
-    std::vector<Item*> GetPlayerItems(const Player* player, bool inBankAlso) const;
+    void AddUpgradedItemToPagedData(const Item* item, const Player* player, PagedData& pagedData, InventoryScope scope);
+
+    template <typename Visitor>
+    static void VisitBagItems(const Player* player, uint8 bagStart, uint8 bagEnd, InventoryScope scope, Visitor& visitor)
+    {
+        for (uint8 i = bagStart; i < bagEnd; i++)
+            if (Bag* bag = player->GetBagByPos(i))
+                for (uint32 j = 0; j < bag->GetBagSize(); j++)
+                    if (Item* item = bag->GetItemByPos(j))
+                        visitor(item, scope);
+    }
     bool IsAllowedItem(const Item* item) const;
     bool IsBlacklistedItem(const Item* item) const;
-    void SendItemPacket(Player* player, Item* item) const;
+    bool SendItemPacket(Player* player, Item* item);
+    /* item is nullptr to send the template */
+    bool SendItemPacket(Player* player, const ItemTemplate* proto, Item* item);
+    /* Sends the template for recorded upgraded entries the player no longer has upgraded */
+    void ResetClientEntries(Player* player, const std::vector<Item*>& visualItems);
+    bool SendItemPacket(CharacterUpgradeState* characterState, const ItemTemplate* proto, const Item* item, const ItemUpgradeState* state,
+        const ModifierSources* pendingSources, int loc_idx, const ItemPacketSink& sink);
+    static Item* FindIndexedItem(const Player* player, ObjectGuid::LowType itemGuid, uint16& pos);
+    std::vector<Item*> ChooseVisualItems(const Player* player, bool inBankAlso) const;
+    void QueueItemPackets(Player* player, const std::vector<Item*>& items, bool bankOnly);
+    static ItemPacketPriority GetItemPacketPriority(const Item* item);
+    void CountMetric(MetricCounter counter) const;
+    static ItemQueryValues GetTemplateQueryValues(const ItemTemplate* proto);
+    ItemQueryValues GetItemQueryValues(const Player* player, Item* item) const;
+    /* item is nullptr for a template without instance (load generator), state nullptr when the item is not upgraded */
+    ItemQueryValues GetItemQueryValues(const ItemTemplate* proto, const Item* item, const ItemUpgradeState* state, const ModifierSources* pendingSources) const;
+    void SendItemQueryResponse(const ItemTemplate* proto, int loc_idx, const ItemQueryValues& values, uint64 signature, const ItemPacketSink& sink);
+    WorldPacket BuildItemQueryResponse(const ItemTemplate* proto, int loc_idx, const ItemQueryValues& values);
+    static ItemQueryTemplate SerializeItemQueryTemplate(const ItemTemplate* pProto, int loc_idx);
+    void ClearItemQueryCache();
+    std::pair<uint32, uint32> GetItemLevel(const Player* player, Item* item) const;
+    uint32 GetItemLevel(const ItemTemplate* proto, const Item* item, const ItemUpgradeState* state, const ModifierSources* pendingSources) const;
     std::pair<uint32, uint32> CalculateItemLevel(const Player* player, Item* item, const UpgradeStat* upgrade = nullptr) const;
     std::pair<uint32, uint32> CalculateItemLevel(const Player* player, Item* item, std::unordered_map<uint32, const UpgradeStat*>) const;
-    void RemoveItemUpgradeFromContainer(CharacterUpgradeContainer& upgradesContainer, Player* player, Item* item);
-    void RemoveItemUpgrade(Player* player, Item* item);
-    void RemoveWeaponUpgrade(Player* player, Item* item);
-    bool AddUpgradeForNewItem(Player* player, Item* item, const UpgradeStat* upgrade, const _ItemStat* stat);
-    void AddItemUpgradeToDB(const Player* player, const Item* item, const UpgradeStat* upgrade) const;
+    void RemoveItemUpgrade(Player* player, Item* item, CharacterDatabaseTransaction trans);
+    void RemoveWeaponUpgrade(Player* player, Item* item, CharacterDatabaseTransaction trans);
+    bool AddUpgradeForNewItem(Player* player, Item* item, const UpgradeStat* upgrade, const _ItemStat* stat, CharacterDatabaseTransaction trans);
+    void AddItemUpgradeToDB(const Player* player, const Item* item, const UpgradeStat* upgrade, CharacterDatabaseTransaction trans) const;
+    /* Appended to trans, executed on its own when there is none */
+    void ExecuteUpgradeWrite(CharacterDatabaseTransaction trans, const std::string& sql) const;
     const UpgradeStat* FindNearestUpgradeStat(uint32 statType, uint16 rank, const Item* item) const;
     bool IsAllowedStatForItem(const Item* item, const UpgradeStat* upgrade) const;
     bool IsBlacklistedStatForItem(const Item* item, const UpgradeStat* upgrade) const;
     bool CanApplyUpgradeForItem(const Item* item, const UpgradeStat* upgrade) const;
     Item* FindItemIdentifierFromPage(const PagedData& pagedData, uint32 id, Player* player) const;
-    void CreateUpgradesPctMap();
+    void CreateUpgradesPctMap(UpgradeDefinitions& newDefinitions) const;
+    static uint8 ComputeItemTemplateFlags(const ItemTemplate* proto, const UpgradeDefinitions& itemDefinitions);
+    void BuildItemTemplateFlags(UpgradeDefinitions& newDefinitions) const;
+    static bool HasEnchantmentStats(const Item* item);
+    static ItemStatInfo ComputeItemStatInfo(const ItemTemplate* proto, const Item* item);
     std::unordered_map<uint32, const UpgradeStat*> FindAllUpgradeableRanks(const Player* player, const Item* item, float pct) const;
     StatRequirementContainer BuildBulkRequirements(const std::unordered_map<uint32, const UpgradeStat*>& upgrades, const Item* item) const;
     void BuildRequirementsPage(const Player* player, PagedData& pagedData, const StatRequirementContainer* reqs) const;
     bool PurchaseUpgradeBulk(Player* player);
-    bool HandlePurchaseRank(Player* player, Item* item, const UpgradeStat* upgrade);
+    bool HandlePurchaseRank(Player* player, Item* item, const UpgradeStat* upgrade, CharacterDatabaseTransaction trans);
     bool HandlePurchaseWeaponUpgrade(Player* player, Item* item, const UpgradeStat* upgrade);
-    bool CheckDataValidity() const;
+    bool CheckDataValidity(const UpgradeDefinitions& newDefinitions) const;
     bool IsValidStatType(uint32 statType) const;
     const StatRequirementContainer* GetStatRequirements(const UpgradeStat* upgrade, const Item* item) const;
     bool EmptyRequirements(const StatRequirementContainer* reqs) const;
@@ -379,8 +868,10 @@ private:
     bool TryAddItem(Player* player, uint32 entry, uint32 count, bool add);
     bool IsAllowedStatType(uint32 statType) const;
     void LoadAllowedStats(const std::string& stats);
+    static std::vector<uint32> ParseAllowedStats(const std::string& stats);
 
     void LoadWeaponUpgradePercents(const std::string& percents);
+    static UpgradeStatContainer ParseWeaponUpgradePercents(const std::string& percents);
     bool MeetsWeaponUpgradeRequirement(const Player* player) const;
 
     bool PurgeUpgrade(Player* player, Item* item);
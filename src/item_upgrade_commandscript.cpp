@@ -6,6 +6,7 @@
 #include "Chat.h"
 #include "CommandScript.h"
 #include "item_upgrade.h"
+#include "item_upgrade_profiler.h"
 
 using namespace Acore::ChatCommands;
 
@@ -14,16 +15,28 @@ class item_upgrade_commandscript : public CommandScript
 private:
     static std::unordered_map<uint32, uint32> cmdListUpgradesTimerMap;
     static constexpr uint32 listUpgradesDiffTimer = 10000;
+    static constexpr uint32 loadTestDefaultItems = 30;
+    static constexpr uint32 loadTestMaxCharacters = 50000;
+    static constexpr uint32 loadTestMaxItems = 200;
 public:
     item_upgrade_commandscript() : CommandScript("item_upgrade_commandscript") { }
 
     ChatCommandTable GetCommands() const override
     {
+        static ChatCommandTable itemUpgradeProfileCommandTable =
+        {
+            { "",      HandleShowProfile,  SEC_ADMINISTRATOR, Console::Yes },
+            { "reset", HandleResetProfile, SEC_ADMINISTRATOR, Console::Yes }
+        };
+
         static ChatCommandTable itemUpgradeSubcommandTable =
         {
-            { "reload", HandleReloadModItemUpgrade, SEC_ADMINISTRATOR, Console::Yes },
-            { "lock",   HandleLockItemUpgrade,      SEC_ADMINISTRATOR, Console::Yes },
-            { "list",   HandleListUpgrades,         SEC_PLAYER,        Console::No  }
+            { "reload",  HandleReloadModItemUpgrade, SEC_ADMINISTRATOR, Console::Yes },
+            { "lock",    HandleLockItemUpgrade,      SEC_ADMINISTRATOR, Console::Yes },
+            { "queue",   HandleItemPacketQueue,      SEC_ADMINISTRATOR, Console::Yes },
+            { "profile", itemUpgradeProfileCommandTable },
+            { "loadtest", HandleLoadTest,            SEC_ADMINISTRATOR, Console::Yes },
+            { "list",    HandleListUpgrades,         SEC_PLAYER,        Console::No  }
         };
 
         static ChatCommandTable itemUpgradeCommandTable =
@@ -36,19 +49,21 @@ public:
 private:
     static bool HandleReloadModItemUpgrade(ChatHandler* handler)
     {
-        ItemUpgrade::PagedDataMap& pagedData = sItemUpgrade->GetPagedDataMap();
-        for (auto& itr : pagedData)
-            itr.second.reloaded = true;
-
-        sItemUpgrade->SetReloading(true);
-        sItemUpgrade->HandleDataReload(false);
-
-        sItemUpgrade->LoadFromDB(true);
+        if (sItemUpgrade->IsModifierMigrationPending())
+        {
+            std::pair<uint32, uint32> progress = sItemUpgrade->GetModifierMigrationProgress();
+            handler->PSendSysMessage("Item Upgrade modifiers of the previous reload are still being re-applied ({}/{} players), retry once done.", progress.first, progress.second);
+            return true;
+        }
 
-        sItemUpgrade->HandleDataReload(true);
-        sItemUpgrade->SetReloading(false);
+        if (!sItemUpgrade->StartDefinitionsReload())
+        {
+            handler->SendSysMessage("Item Upgrade module data is already being reloaded.");
+            return true;
+        }
 
-        handler->SendGlobalGMSysMessage("Item Upgrade module data successfully reloaded.");
+        // the NPC keeps serving the current data meanwhile, open menus are dropped once the new data is published
+        handler->SendSysMessage("Item Upgrade module data reload started, GMs will be notified when it completes.");
         return true;
     }
 
@@ -59,6 +74,79 @@ private:
         return true;
     }
 
+    static bool HandleItemPacketQueue(ChatHandler* handler)
+    {
+        ItemUpgrade::ItemPacketQueueStats stats = sItemUpgrade->GetItemPacketQueueStats();
+        handler->PSendSysMessage("Item Upgrade login packet queue: {} equipped, {} bags, {} bank item packet(s) waiting.",
+            stats.depth[ItemUpgrade::ITEM_PACKET_PRIORITY_EQUIPPED],
+            stats.depth[ItemUpgrade::ITEM_PACKET_PRIORITY_BAGS],
+            stats.depth[ItemUpgrade::ITEM_PACKET_PRIORITY_BANK]);
+        handler->PSendSysMessage("Sent {} packet(s) since startup, drain latency: average {} ms, max {} ms.", stats.sentPackets, stats.averageLatency, stats.maxLatency);
+        return true;
+    }
+
+    static bool HandleShowProfile(ChatHandler* handler)
+    {
+        if (!ItemUpgradeProfiler::IsEnabled())
+            handler->SendSysMessage("Item Upgrade profiling is disabled (ItemUpgrade.Profile), showing what was recorded while it was enabled.");
+
+        handler->SendSysMessage("Item Upgrade hot paths, latencies in ns: calls / mean / p50 / p90 / p99 / p99.9 / max");
+        for (uint32 i = 0; i < MAX_ITEM_UPGRADE_PROFILE_POINTS; i++)
+        {
+            ItemUpgradeProfilePoint point = (ItemUpgradeProfilePoint)i;
+            ItemUpgradeProfiler::Summary summary = sItemUpgradeProfiler->Summarize(point);
+            handler->PSendSysMessage("{}: {} / {} / {} / {} / {} / {} / {}", ItemUpgradeProfiler::ProfilePointToString(point),
+                summary.count, summary.mean, summary.p50, summary.p90, summary.p99, summary.p999, summary.max);
+        }
+        return true;
+    }
+
+    static bool HandleResetProfile(ChatHandler* handler)
+    {
+        sItemUpgradeProfiler->Reset();
+        handler->SendSysMessage("Item Upgrade profiling counters were reset.");
+        return true;
+    }
+
+    static bool HandleLoadTest(ChatHandler* handler, uint32 characters, Optional<uint32> items)
+    {
+        if (!sItemUpgrade->GetBoolConfig(CONFIG_ITEM_UPGRADE_LOAD_TEST))
+        {
+            handler->SendSysMessage("Item Upgrade load test is disabled, enable ItemUpgrade.LoadTest first.");
+            return true;
+        }
+
+        uint32 itemsPerCharacter = items.value_or(loadTestDefaultItems);
+        if (characters == 0 || characters > loadTestMaxCharacters || itemsPerCharacter == 0 || itemsPerCharacter > loadTestMaxItems)
+        {
+            handler->PSendSysMessage("Use 1 to {} characters and 1 to {} items per character.", loadTestMaxCharacters, loadTestMaxItems);
+            return true;
+        }
+
+        // the test ends with a full reload, it can not overlap with one
+        if (sItemUpgrade->GetReloading() || sItemUpgrade->IsDefinitionsReloadPending() || sItemUpgrade->IsModifierMigrationPending())
+        {
+            handler->SendSysMessage("Item Upgrade module is locked or being reloaded, retry once the lock is released.");
+            return true;
+        }
+
+        ItemUpgrade::LoadTestReport report = sItemUpgrade->RunLoadTest(characters, itemsPerCharacter);
+        if (report.characters == 0)
+        {
+            handler->SendSysMessage("Item Upgrade load test found no upgradable item or no upgrade stat, nothing was done.");
+            return true;
+        }
+
+        handler->PSendSysMessage("Item Upgrade load test: {} characters, {} items, {} stat upgrades, {} weapon upgrades, {} item packets ({} bytes).",
+            report.characters, report.items, report.statUpgrades, report.weaponUpgrades, report.packets, report.packetBytes);
+        for (const ItemUpgrade::LoadTestPhase& phase : report.phases)
+            handler->PSendSysMessage("{}: {:.2f} ms, heap {:+} KB, peak RSS {} KB", phase.name, phase.elapsedUs / 1000.0, phase.heapGrowth / 1024, phase.peakRssKB);
+        if (!report.reloaded)
+            handler->SendSysMessage("Data reload FAILED, check the FATAL error messages. Previous data is still in use.");
+
+        return true;
+    }
+
     static bool HandleListUpgrades(ChatHandler* handler, Optional<PlayerIdentifier> target)
     {
         if (!target)
@@ -68,6 +156,11 @@ private:
             return false;
 
         Player* player = target->GetConnectedPlayer();
+        if (!sItemUpgrade->IsCharacterUpgradeDataLoaded(player))
+        {
+            handler->PSendSysMessage("Upgrades of {} are still being loaded, please retry.", player->GetPlayerName());
+            return true;
+        }
 
         uint32 currentTime = getMSTime();
         uint32 lastTime = cmdListUpgradesTimerMap[player->GetGUID().GetCounter()];
@@ -97,7 +190,7 @@ private:
                     if (!upgrades.empty())
                     {
                         upgradedStats += upgrades.size();
-                        std::vector<_ItemStat> statInfo = ItemUpgrade::LoadItemStatInfo(item);
+                        ItemUpgrade::ItemStatInfo statInfo = sItemUpgrade->LoadItemStatInfo(item);
                         handler->PSendSysMessage("Found {} stat upgrades:", upgrades.size());
                         for (const auto* stat : upgrades)
                         {
@@ -27,6 +27,10 @@ void ItemUpgradeConfig::Initialize()
     boolConfigs[CONFIG_ITEM_UPGRADE_RANDOM_UPGRADES_QUEST_REWARD] = sConfigMgr->GetOption<bool>("ItemUpgrade.RandomUpgradeOnQuestReward", true);
     boolConfigs[CONFIG_ITEM_UPGRADE_RANDOM_UPGRADES_CRAFTING] = sConfigMgr->GetOption<bool>("ItemUpgrade.RandomUpgradeWhenCrafting", true);
     boolConfigs[CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE] = sConfigMgr->GetOption<bool>("ItemUpgrade.UpgradeWeaponDamage", true);
+    boolConfigs[CONFIG_ITEM_UPGRADE_WRITE_BEHIND] = sConfigMgr->GetOption<bool>("ItemUpgrade.WriteBehind", false);
+    boolConfigs[CONFIG_ITEM_UPGRADE_PROFILE] = sConfigMgr->GetOption<bool>("ItemUpgrade.Profile", false);
+    boolConfigs[CONFIG_ITEM_UPGRADE_METRICS] = sConfigMgr->GetOption<bool>("ItemUpgrade.Metrics", false);
+    boolConfigs[CONFIG_ITEM_UPGRADE_LOAD_TEST] = sConfigMgr->GetOption<bool>("ItemUpgrade.LoadTest", false);
 
     stringConfigs[CONFIG_ITEM_UPGRADE_ALLOWED_STATS] = sConfigMgr->GetOption<std::string>("ItemUpgrade.AllowedStats", "0,3,4,5,6,7,32,36,45");
     stringConfigs[CONFIG_ITEM_UPGRADE_RANDOM_UPGRADES_LOGIN_MSG] = sConfigMgr->GetOption<std::string>("ItemUpgrade.RandomUpgradesBroadcastLoginMsg", "");
@@ -62,6 +66,24 @@ void ItemUpgradeConfig::Initialize()
     intConfigs[CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_MONEY] = sConfigMgr->GetOption<int32>("ItemUpgrade.UpgradeWeaponDamageMoney", 0);
     if (intConfigs[CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_MONEY] < 0 || intConfigs[CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_MONEY] > MAX_MONEY_AMOUNT)
         intConfigs[CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_MONEY] = 0;
+    intConfigs[CONFIG_ITEM_UPGRADE_RELOAD_PLAYERS_PER_UPDATE] = sConfigMgr->GetOption<int32>("ItemUpgrade.ReloadPlayersPerUpdate", 50);
+    if (intConfigs[CONFIG_ITEM_UPGRADE_RELOAD_PLAYERS_PER_UPDATE] < 0)
+        intConfigs[CONFIG_ITEM_UPGRADE_RELOAD_PLAYERS_PER_UPDATE] = 0;
+    intConfigs[CONFIG_ITEM_UPGRADE_RELOAD_MICROSECONDS_PER_UPDATE] = sConfigMgr->GetOption<int32>("ItemUpgrade.ReloadMicrosecondsPerUpdate", 2000);
+    if (intConfigs[CONFIG_ITEM_UPGRADE_RELOAD_MICROSECONDS_PER_UPDATE] < 0)
+        intConfigs[CONFIG_ITEM_UPGRADE_RELOAD_MICROSECONDS_PER_UPDATE] = 0;
+    intConfigs[CONFIG_ITEM_UPGRADE_ITEM_QUERY_CACHE_SIZE] = sConfigMgr->GetOption<int32>("ItemUpgrade.ItemQueryCacheSize", 2048);
+    if (intConfigs[CONFIG_ITEM_UPGRADE_ITEM_QUERY_CACHE_SIZE] < 0)
+        intConfigs[CONFIG_ITEM_UPGRADE_ITEM_QUERY_CACHE_SIZE] = 0;
+    intConfigs[CONFIG_ITEM_UPGRADE_LOGIN_PACKETS_PER_UPDATE] = sConfigMgr->GetOption<int32>("ItemUpgrade.LoginPacketsPerUpdate", 100);
+    if (intConfigs[CONFIG_ITEM_UPGRADE_LOGIN_PACKETS_PER_UPDATE] < 0)
+        intConfigs[CONFIG_ITEM_UPGRADE_LOGIN_PACKETS_PER_UPDATE] = 0;
+    intConfigs[CONFIG_ITEM_UPGRADE_STAT_INFO_CACHE_SIZE] = sConfigMgr->GetOption<int32>("ItemUpgrade.StatInfoCacheSize", 4096);
+    if (intConfigs[CONFIG_ITEM_UPGRADE_STAT_INFO_CACHE_SIZE] < 0)
+        intConfigs[CONFIG_ITEM_UPGRADE_STAT_INFO_CACHE_SIZE] = 0;
+    intConfigs[CONFIG_ITEM_UPGRADE_METRICS_INTERVAL] = sConfigMgr->GetOption<int32>("ItemUpgrade.MetricsInterval", 10000);
+    if (intConfigs[CONFIG_ITEM_UPGRADE_METRICS_INTERVAL] < 1000)
+        intConfigs[CONFIG_ITEM_UPGRADE_METRICS_INTERVAL] = 1000;
 }
 
 bool ItemUpgradeConfig::GetBoolConfig(ItemUpgradeBoolConfigs index) const
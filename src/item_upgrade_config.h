@@ -21,6 +21,10 @@ enum ItemUpgradeBoolConfigs
     CONFIG_ITEM_UPGRADE_RANDOM_UPGRADES_QUEST_REWARD,
     CONFIG_ITEM_UPGRADE_RANDOM_UPGRADES_CRAFTING,
     CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE,
+    CONFIG_ITEM_UPGRADE_WRITE_BEHIND,
+    CONFIG_ITEM_UPGRADE_PROFILE,
+    CONFIG_ITEM_UPGRADE_METRICS,
+    CONFIG_ITEM_UPGRADE_LOAD_TEST,
     MAX_ITEM_UPGRADE_BOOL_CONFIGS
 };
 
@@ -48,6 +52,12 @@ enum ItemUpgradeIntConfigs
     CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_TOKEN_COUNT,
     CONFIG_ITEM_UPGRADE_WEAPON_DAMAGE_MONEY,
     CONFIG_ITEM_UPGRADE_SEND_PACKETS_PRIORITY,
+    CONFIG_ITEM_UPGRADE_RELOAD_PLAYERS_PER_UPDATE,
+    CONFIG_ITEM_UPGRADE_RELOAD_MICROSECONDS_PER_UPDATE,
+    CONFIG_ITEM_UPGRADE_ITEM_QUERY_CACHE_SIZE,
+    CONFIG_ITEM_UPGRADE_LOGIN_PACKETS_PER_UPDATE,
+    CONFIG_ITEM_UPGRADE_STAT_INFO_CACHE_SIZE,
+    CONFIG_ITEM_UPGRADE_METRICS_INTERVAL,
     MAX_ITEM_UPGRADE_INT_CONFIGS
 };
 
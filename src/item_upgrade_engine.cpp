@@ -0,0 +1,130 @@
+/*
+ * Credits: silviu20092
+ */
+
+#include "item_upgrade_engine.h"
+
+/*static*/ int32 ItemUpgradeEngine::CalculateModPct(int32 value, const UpgradeStat* upgradeStat)
+{
+    int32 newAmount = (int32)(value * (1 + upgradeStat->statModPct / 100.0f));
+    return std::max(newAmount, value + upgradeStat->statRank);
+}
+
+/*static*/ float ItemUpgradeEngine::CalculateModPctF(float value, const UpgradeStat* upgradeStat)
+{
+    float newAmount = value * (1.0f + upgradeStat->statModPct / 100.0f);
+    return std::max(newAmount, value + upgradeStat->statRank);
+}
+
+/*static*/ uint8 ItemUpgradeEngine::MergeStatRequirements(uint32 statId, StatRequirementContainer& reqs, const RequirementLimits* limits)
+{
+    uint8 rejected = 0;
+    StatRequirementContainer newStatReq;
+
+    uint64 copperTotal = std::accumulate(reqs.begin(), reqs.end(), uint64(0),
+        [](uint64 a, const UpgradeStatReq& req) { return a + (req.reqType == REQ_TYPE_COPPER ? req.copper : 0); });
+    if (copperTotal > 0)
+    {
+        if (limits != nullptr && copperTotal > limits->copper)
+            rejected |= MERGE_REJECTED_COPPER;
+        else
+            newStatReq.push_back(UpgradeStatReq::Copper(statId, copperTotal));
+    }
+
+    uint64 honorTotal = std::accumulate(reqs.begin(), reqs.end(), uint64(0),
+        [](uint64 a, const UpgradeStatReq& req) { return a + (req.reqType == REQ_TYPE_HONOR ? req.points : 0); });
+    if (honorTotal > 0)
+    {
+        if (limits != nullptr && honorTotal > limits->honor)
+            rejected |= MERGE_REJECTED_HONOR;
+        else
+            newStatReq.push_back(UpgradeStatReq::Points(statId, REQ_TYPE_HONOR, uint32(honorTotal)));
+    }
+
+    uint64 arenaTotal = std::accumulate(reqs.begin(), reqs.end(), uint64(0),
+        [](uint64 a, const UpgradeStatReq& req) { return a + (req.reqType == REQ_TYPE_ARENA ? req.points : 0); });
+    if (arenaTotal > 0)
+    {
+        if (limits != nullptr && arenaTotal > limits->arena)
+            rejected |= MERGE_REJECTED_ARENA;
+        else
+            newStatReq.push_back(UpgradeStatReq::Points(statId, REQ_TYPE_ARENA, uint32(arenaTotal)));
+    }
+
+    std::unordered_map<uint32, uint32> itemCountMap;
+    for (const UpgradeStatReq& req : reqs)
+    {
+        if (req.reqType != REQ_TYPE_ITEM)
+            continue;
+
+        itemCountMap[req.itemEntry] += req.itemCount;
+    }
+    for (const auto& itemPair : itemCountMap)
+        newStatReq.push_back(UpgradeStatReq::Items(statId, itemPair.first, itemPair.second));
+
+    StatRequirementContainer::const_iterator citer = std::find_if(reqs.begin(), reqs.end(),
+        [&](const UpgradeStatReq& req) { return req.reqType == REQ_TYPE_NONE; });
+    if (citer != reqs.end())
+        newStatReq.push_back(UpgradeStatReq(statId, REQ_TYPE_NONE));
+
+    reqs = newStatReq;
+    return rejected;
+}
+
+/*static*/ ItemUpgradeEngine::StatRequirementContainer ItemUpgradeEngine::BuildBulkRequirements(const std::vector<const StatRequirementContainer*>& requirements, uint64 maxCopper)
+{
+    StatRequirementContainer reqs;
+
+    uint64 copper = 0;
+    uint32 arena = 0;
+    uint32 honor = 0;
+    std::unordered_map<uint32, uint32> itemMap;
+    for (const StatRequirementContainer* ureq : requirements)
+    {
+        if (ureq == nullptr)
+            continue;
+
+        for (const UpgradeStatReq& statReq : *ureq)
+        {
+            switch (statReq.reqType)
+            {
+                case REQ_TYPE_COPPER:
+                    copper += statReq.copper;
+                    break;
+                case REQ_TYPE_HONOR:
+                    honor += statReq.points;
+                    break;
+                case REQ_TYPE_ARENA:
+                    arena += statReq.points;
+                    break;
+                case REQ_TYPE_ITEM:
+                    itemMap[statReq.itemEntry] += statReq.itemCount;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    if (copper != 0)
+        reqs.push_back(UpgradeStatReq::Copper(0, std::min(copper, maxCopper)));
+
+    if (honor != 0)
+        reqs.push_back(UpgradeStatReq::Points(0, REQ_TYPE_HONOR, honor));
+
+    if (arena != 0)
+        reqs.push_back(UpgradeStatReq::Points(0, REQ_TYPE_ARENA, arena));
+
+    for (const auto& ipair : itemMap)
+        reqs.push_back(UpgradeStatReq::Items(0, ipair.first, ipair.second));
+
+    return reqs;
+}
+
+/*static*/ const ItemUpgradeEngine::UpgradeStat* ItemUpgradeEngine::FindUpgradeStat(const UpgradeStatRanks& ranks, uint16 rank)
+{
+    if (rank == 0 || rank > ranks.size())
+        return nullptr;
+
+    return ranks[rank - 1];
+}
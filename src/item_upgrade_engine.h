@@ -0,0 +1,196 @@
+/*
+ * Credits: silviu20092
+ */
+
+#ifndef _ITEM_UPGRADE_ENGINE_H_
+#define _ITEM_UPGRADE_ENGINE_H_
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+#include "Define.h"
+
+/*
+ * Upgrade data types and the computations done on them, free of any world state (players, items, DB, config),
+ * so they can be driven on synthetic data too (see benchmark/). Anything that needs world state is passed in
+ * by the caller, ItemUpgrade is the only user inside the worldserver.
+ */
+class ItemUpgradeEngine
+{
+public:
+    enum UpgradeStatReqType
+    {
+        REQ_TYPE_COPPER = 1,
+        REQ_TYPE_HONOR,
+        REQ_TYPE_ARENA,
+        REQ_TYPE_ITEM,
+        REQ_TYPE_NONE,
+        MAX_REQ_TYPE
+    };
+
+    struct UpgradeStatReq
+    {
+        /* Associated stat ID from UpgradeStat */
+        uint32 statId;
+
+        /*
+            Possible values:
+                1 = this rank requires money (copper, gold) to be bought
+                2 = this rank requires honor points to be bought
+                3 = this rank requires arena points to be bought
+                4 = this rank requires certain item(s) to be bought
+         */
+        UpgradeStatReqType reqType;
+
+        /* If reqType = 1 THEN required copper to purchase rank (req_val1) */
+        uint64 copper;
+
+        /*
+         *   If reqType = 2 THEN required honor points to purchase rank (req_val1)
+         *   If reqType = 3 THEN required arena points to purchase rank (req_val1)
+         */
+        uint32 points;
+
+        /* If reqType = 4 THEN item ENTRY (from item_template.entry, req_val1) and item count (req_val2) required to purchase rank */
+        uint32 itemEntry;
+        uint32 itemCount;
+
+        UpgradeStatReq() : statId(0), reqType(MAX_REQ_TYPE), copper(0), points(0), itemEntry(0), itemCount(0) {}
+
+        UpgradeStatReq(uint32 statId, UpgradeStatReqType reqType)
+            : statId(statId), reqType(reqType), copper(0), points(0), itemEntry(0), itemCount(0) {}
+
+        static UpgradeStatReq Copper(uint32 statId, uint64 copper)
+        {
+            UpgradeStatReq req(statId, REQ_TYPE_COPPER);
+            req.copper = copper;
+            return req;
+        }
+
+        /* reqType is REQ_TYPE_HONOR or REQ_TYPE_ARENA */
+        static UpgradeStatReq Points(uint32 statId, UpgradeStatReqType reqType, uint32 points)
+        {
+            UpgradeStatReq req(statId, reqType);
+            req.points = points;
+            return req;
+        }
+
+        static UpgradeStatReq Items(uint32 statId, uint32 itemEntry, uint32 itemCount)
+        {
+            UpgradeStatReq req(statId, REQ_TYPE_ITEM);
+            req.itemEntry = itemEntry;
+            req.itemCount = itemCount;
+            return req;
+        }
+    };
+    typedef std::vector<UpgradeStatReq> StatRequirementContainer;
+
+    struct UpgradeStat
+    {
+        uint32 statId;
+        uint32 statType;
+        float statModPct;
+        uint16 statRank;
+    };
+    typedef std::vector<UpgradeStat> UpgradeStatContainer;
+    /* Ranks of a single stat type, indexed by statRank - 1 */
+    typedef std::vector<const UpgradeStat*> UpgradeStatRanks;
+
+    /* Upper bounds of merged requirement totals, a total above its bound is dropped */
+    struct RequirementLimits
+    {
+        uint64 copper;
+        uint32 honor;
+        uint32 arena;
+    };
+
+    /* Totals MergeStatRequirements dropped because of RequirementLimits */
+    enum MergeRejection
+    {
+        MERGE_REJECTED_COPPER = 0x1,
+        MERGE_REJECTED_HONOR  = 0x2,
+        MERGE_REJECTED_ARENA  = 0x4
+    };
+
+    static int32 CalculateModPct(int32 value, const UpgradeStat* upgradeStat);
+    static float CalculateModPctF(float value, const UpgradeStat* upgradeStat);
+
+    /*
+     * One requirement per currency and per item entry, summed over reqs. limits is nullptr when totals are not checked,
+     * returns the MergeRejection flags of the dropped totals.
+     */
+    static uint8 MergeStatRequirements(uint32 statId, StatRequirementContainer& reqs, const RequirementLimits* limits);
+
+    /* Sum of the requirements of several ranks bought at once, copper is capped to maxCopper */
+    static StatRequirementContainer BuildBulkRequirements(const std::vector<const StatRequirementContainer*>& requirements, uint64 maxCopper);
+
+    static const UpgradeStat* FindUpgradeStat(const UpgradeStatRanks& ranks, uint16 rank);
+
+    /* Stats is a list of objects with ItemStatType and ItemStatValue (_ItemStat) */
+    template <typename Stats>
+    static auto FindStatByType(const Stats& stats, uint32 statType) -> decltype(&*std::begin(stats))
+    {
+        auto found = std::find_if(std::begin(stats), std::end(stats), [&](const auto& stat) { return stat.ItemStatType == statType; });
+        if (found != std::end(stats))
+            return &*found;
+        return nullptr;
+    }
+
+    /*
+     * Next rank of every stat of the item that can be bought from candidates (the ranks of one upgrade percent).
+     * ranksByType is indexed by stat type, canUpgrade(const UpgradeStat*) filters out ranks that can not be applied
+     * and currentUpgrade(statType) returns the rank the item already has, nullptr if none.
+     */
+    template <typename Stats, typename RankIndex, typename CanUpgrade, typename CurrentUpgrade>
+    static std::unordered_map<uint32, const UpgradeStat*> FindAllUpgradeableRanks(const std::vector<const UpgradeStat*>& candidates, const Stats& stats,
+        const RankIndex& ranksByType, CanUpgrade&& canUpgrade, CurrentUpgrade&& currentUpgrade)
+    {
+        std::unordered_map<uint32, const UpgradeStat*> possibleUpgrades;
+        for (const UpgradeStat* stat : candidates)
+        {
+            if (FindStatByType(stats, stat->statType) == nullptr)
+                continue;
+
+            if (!canUpgrade(stat))
+                continue;
+
+            const UpgradeStat* current = currentUpgrade(stat->statType);
+            if (current != nullptr)
+            {
+                const UpgradeStat* nextUpgrade = stat->statType < ranksByType.size() ? FindUpgradeStat(ranksByType[stat->statType], current->statRank + 1) : nullptr;
+                if (nextUpgrade != nullptr && current->statRank == stat->statRank - 1)
+                    possibleUpgrades[stat->statType] = stat;
+            }
+            else
+            {
+                if (stat->statRank == 1)
+                    possibleUpgrades[stat->statType] = stat;
+            }
+        }
+        return possibleUpgrades;
+    }
+
+    /*
+     * Item level scaled by how much the stat budget grew, modifier(stat) returns the upgraded value of a stat.
+     * Never lower than itemLevel.
+     */
+    template <typename Stats, typename StatModifier>
+    static uint32 CalculateItemLevel(uint32 itemLevel, const Stats& stats, StatModifier&& modifier)
+    {
+        if (std::begin(stats) == std::end(stats))
+            return itemLevel;
+
+        uint32 originalSum = std::accumulate(std::begin(stats), std::end(stats), 0, [](uint32 a, const auto& stat) { return a + stat.ItemStatValue; });
+        uint32 upgradedSum = 0;
+        for (const auto& stat : stats)
+            upgradedSum += (uint32)modifier(stat);
+
+        if (upgradedSum <= originalSum)
+            return itemLevel;
+
+        return (upgradedSum * itemLevel) / originalSum;
+    }
+};
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * Credits: silviu20092
+ */
+
+#include <chrono>
+#include <limits>
+#include <random>
+#include "ObjectMgr.h"
+#include "ObjectAccessor.h"
+#include "Log.h"
+#include "item_upgrade.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    /* Bytes currently allocated from the heap, 0 where the allocator can not tell */
+    int64 GetHeapInUse()
+    {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        struct mallinfo2 info = mallinfo2();
+        return int64(info.uordblks + info.hblkhd);
+#else
+        return 0;
+#endif
+    }
+
+    /* Peak resident set size of the process in KB, 0 where it is not available */
+    uint64 GetPeakRssKB()
+    {
+#if defined(_WIN32)
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+#if defined(__APPLE__)
+        // reported in bytes there
+        return uint64(usage.ru_maxrss) / 1024;
+#else
+        return uint64(usage.ru_maxrss);
+#endif
+#endif
+    }
+
+    template <typename Func>
+    void RunLoadTestPhase(ItemUpgrade::LoadTestReport& report, const std::string& name, Func&& func)
+    {
+        int64 heapBefore = GetHeapInUse();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        func();
+        uint64 elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        report.phases.push_back({ name, elapsed, GetHeapInUse() - heapBefore, GetPeakRssKB() });
+    }
+}
+
+ItemUpgrade::LoadTestReport ItemUpgrade::RunLoadTest(uint32 characters, uint32 itemsPerCharacter)
+{
+    // what the login queries would have returned, kept apart so building it is not measured
+    struct FabricatedCharacter
+    {
+        std::unique_ptr<CharacterUpgradeState> state;
+        uint32 guid;
+        std::vector<std::pair<ObjectGuid::LowType, uint32>> statRows;
+        std::vector<std::pair<ObjectGuid::LowType, float>> weaponRows;
+        std::vector<std::pair<ObjectGuid::LowType, const ItemTemplate*>> items;
+    };
+
+    LoadTestReport report;
+    const UpgradeDefinitions& currentDefinitions = GetDefinitions();
+
+    std::vector<const ItemTemplate*> candidates;
+    for (const ItemTemplate* proto : *sObjectMgr->GetItemTemplateStoreFast())
+    {
+        if (proto == nullptr)
+            continue;
+
+        uint8 flags = currentDefinitions.GetItemTemplateFlags(proto);
+        if ((flags & ITEM_TEMPLATE_FLAG_HAS_STATS) && (flags & ITEM_TEMPLATE_FLAG_ALLOWED) && !(flags & ITEM_TEMPLATE_FLAG_BLACKLISTED))
+            candidates.push_back(proto);
+    }
+
+    if (candidates.empty() || currentDefinitions.upgradeStatList.empty())
+        return report;
+
+    // fixed seed, two runs against the same data fabricate the same characters
+    std::mt19937 rng(20092);
+    std::vector<FabricatedCharacter> fabricated;
+    fabricated.reserve(characters);
+
+    // GUIDs are taken from the top of the range and never collide with a character that is online
+    ObjectGuid::LowType itemGuid = 0;
+    for (uint32 guid = std::numeric_limits<uint32>::max(); fabricated.size() < characters && guid > 0; guid--)
+    {
+        if (FindCharacterUpgradeState(guid) != nullptr || ObjectAccessor::FindPlayerByLowGUID(guid) != nullptr)
+            continue;
+
+        FabricatedCharacter character;
+        character.guid = guid;
+        for (uint32 i = 0; i < itemsPerCharacter; i++)
+        {
+            const ItemTemplate* proto = candidates[rng() % candidates.size()];
+            character.items.emplace_back(++itemGuid, proto);
+
+            for (uint32 j = 0; j < proto->StatsCount && j < MAX_ITEM_PROTO_STATS; ++j)
+            {
+                uint32 statType = proto->ItemStat[j].ItemStatType;
+                if (statType >= MAX_ITEM_MOD || currentDefinitions.upgradeStatsByType[statType].empty())
+                    continue;
+
+                const UpgradeStatRanks& ranks = currentDefinitions.upgradeStatsByType[statType];
+                character.statRows.emplace_back(itemGuid, ranks[rng() % ranks.size()]->statId);
+            }
+
+            if ((currentDefinitions.GetItemTemplateFlags(proto) & ITEM_TEMPLATE_FLAG_HAS_WEAPON_DAMAGE) && !weaponUpgradeStats.empty())
+                character.weaponRows.emplace_back(itemGuid, weaponUpgradeStats[rng() % weaponUpgradeStats.size()].statModPct);
+        }
+        fabricated.push_back(std::move(character));
+    }
+
+    report.characters = fabricated.size();
+    report.items = report.characters * itemsPerCharacter;
+
+    // same work as LoadCharacterItemUpgrades and LoadCharacterWeaponUpgrades, without players and their equipped items
+    RunLoadTestPhase(report, "login", [&]()
+    {
+        for (FabricatedCharacter& character : fabricated)
+        {
+            character.state = std::make_unique<CharacterUpgradeState>(character.guid);
+            CharacterUpgradeState& characterState = *character.state;
+            RegisterCharacterUpgradeState(&characterState);
+
+            for (const auto& row : character.statRows)
+            {
+                const UpgradeStat* upgradeStat = FindUpgradeStat(row.second);
+                if (upgradeStat == nullptr)
+                    continue;
+
+                SetItemUpgradeStat(characterState.items[row.first], upgradeStat);
+                report.statUpgrades++;
+            }
+            characterState.itemUpgradesLoaded = true;
+
+            for (const auto& row : character.weaponRows)
+            {
+                const UpgradeStat* weaponUpgrade = FindWeaponUpgradeStat(row.second);
+                if (weaponUpgrade == nullptr)
+                    weaponUpgrade = FindNearestWeaponUpgradeStat(row.second);
+                if (weaponUpgrade == nullptr)
+                    continue;
+
+                ItemUpgradeState& state = characterState.items[row.first];
+                state.weaponUpgrade = weaponUpgrade;
+                state.weaponUpgradeModPct = row.second;
+                report.weaponUpgrades++;
+            }
+            characterState.weaponUpgradesLoaded = true;
+            characterState.clientEntriesLoaded = true;
+        }
+    });
+
+    for (FabricatedCharacter& character : fabricated)
+    {
+        std::vector<std::pair<ObjectGuid::LowType, uint32>>().swap(character.statRows);
+        std::vector<std::pair<ObjectGuid::LowType, float>>().swap(character.weaponRows);
+    }
+
+    // what UpdateVisualCache sends at login, through the same item query path and caches, into a sink that only counts
+    RunLoadTestPhase(report, "packets", [&]()
+    {
+        ItemPacketSink sink = [&report](const WorldPacket* packet)
+        {
+            report.packets++;
+            report.packetBytes += packet->size();
+        };
+
+        // the command refuses to run during a migration, no character is bound to previous modifier sources
+        for (FabricatedCharacter& character : fabricated)
+        {
+            CharacterUpgradeState& characterState = *character.state;
+            for (const auto& item : character.items)
+            {
+                ItemUpgradeContainer::const_iterator citer = characterState.items.find(item.first);
+                if (citer != characterState.items.end())
+                    SendItemPacket(&characterState, item.second, nullptr, &citer->second, nullptr, LOCALE_enUS, sink);
+            }
+        }
+    });
+
+    // same steps as .item_upgrade reload, done in one go: the fabricated characters are migrated along with the online ones
+    RunLoadTestPhase(report, "reload", [&]()
+    {
+        std::unique_ptr<const UpgradeDefinitions> newDefinitions = BuildDefinitions(GetRequirementLimits());
+        if (!newDefinitions)
+            return;
+
+        PublishDefinitions(std::move(newDefinitions));
+        FinishModifierMigration();
+        report.reloaded = true;
+    });
+
+    if (!report.reloaded)
+        report.phases.pop_back();
+
+    // states unregister themselves when destroyed, as on logout
+    RunLoadTestPhase(report, "logout", [&]()
+    {
+        fabricated.clear();
+    });
+
+    LOG_INFO("server.loading", "Item upgrade load test: {} characters, {} items, {} stat upgrades, {} weapon upgrades, {} item packets ({} bytes)",
+        report.characters, report.items, report.statUpgrades, report.weaponUpgrades, report.packets, report.packetBytes);
+    for (const LoadTestPhase& phase : report.phases)
+        LOG_INFO("server.loading", "Item upgrade load test phase {}: {} us, heap {:+} bytes, peak RSS {} KB", phase.name, phase.elapsedUs, phase.heapGrowth, phase.peakRssKB);
+
+    return report;
+}
@@ -5,6 +5,7 @@
 #include "ScriptMgr.h"
 #include "DatabaseEnv.h"
 #include "Player.h"
+#include "Log.h"
 #include "item_upgrade.h"
 
 class item_upgrade_playerscript : public PlayerScript
@@ -13,20 +14,32 @@ private:
     class SendUpgradePackets : public BasicEvent
     {
     public:
-        SendUpgradePackets(Player* player) : player(player)
+        SendUpgradePackets(Player* player, uint32 attempt = 0) : player(player), attempt(attempt)
         {
             player->m_Events.AddEvent(this, player->m_Events.CalculateTime(DELAY_MS));
         }
 
         bool Execute(uint64 /*e_time*/, uint32 /*p_time*/)
         {
-            sItemUpgrade->UpdateVisualCache(player);
+            // upgrades are loaded asynchronously at login, wait for them before sending the item packets
+            if (!sItemUpgrade->IsCharacterUpgradeDataLoaded(player))
+            {
+                if (attempt + 1 < MAX_ATTEMPTS)
+                    new SendUpgradePackets(player, attempt + 1);
+                else
+                    LOG_ERROR("sql.sql", "Item upgrades of {} were not loaded after {} seconds, upgraded item packets are not sent", player->GetName(), MAX_ATTEMPTS * DELAY_MS / 1000);
+                return true;
+            }
+
+            sItemUpgrade->QueueVisualCacheUpdate(player);
             return true;
         }
     private:
         static constexpr uint64 DELAY_MS = 3000;
+        static constexpr uint32 MAX_ATTEMPTS = 20;
 
         Player* player;
+        uint32 attempt;
     };
 public:
     item_upgrade_playerscript() : PlayerScript("item_upgrade_playerscript",
@@ -35,7 +48,10 @@ public:
             PLAYERHOOK_ON_APPLY_ENCHANTMENT_ITEM_MODS_BEFORE,
             PLAYERHOOK_ON_AFTER_MOVE_ITEM_FROM_INVENTORY,
             PLAYERHOOK_ON_DELETE_FROM_DB,
+            PLAYERHOOK_ON_LOAD_FROM_DB,
             PLAYERHOOK_ON_LOGIN,
+            PLAYERHOOK_ON_LOGOUT,
+            PLAYERHOOK_ON_SAVE,
             PLAYERHOOK_ON_LOOT_ITEM,
             PLAYERHOOK_ON_GROUP_ROLL_REWARD_ITEM,
             PLAYERHOOK_ON_QUEST_REWARD_ITEM,
@@ -63,9 +79,25 @@ public:
     {
         trans->Append("DELETE FROM character_item_upgrade WHERE guid = {}", guid);
         trans->Append("DELETE FROM character_weapon_upgrade WHERE guid = {}", guid);
+        trans->Append("DELETE FROM character_item_upgrade_sent WHERE guid = {}", guid);
         sItemUpgrade->HandleCharacterRemove(guid);
     }
 
+    void OnPlayerLoadFromDB(Player* player) override
+    {
+        sItemUpgrade->LoadCharacterUpgradeData(player);
+    }
+
+    void OnPlayerLogout(Player* player) override
+    {
+        sItemUpgrade->UnloadCharacterUpgradeData(player);
+    }
+
+    void OnPlayerSave(Player* player) override
+    {
+        sItemUpgrade->FlushUpgradeJournal(player);
+    }
+
     void OnPlayerLogin(Player* player) override
     {
         new SendUpgradePackets(player);
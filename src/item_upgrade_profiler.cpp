@@ -0,0 +1,131 @@
+/*
+ * Credits: silviu20092
+ */
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include "item_upgrade_profiler.h"
+
+std::atomic<bool> ItemUpgradeProfiler::enabled = false;
+
+ItemUpgradeProfiler::ItemUpgradeProfiler()
+{
+    Reset();
+}
+
+ItemUpgradeProfiler* ItemUpgradeProfiler::instance()
+{
+    static ItemUpgradeProfiler instance;
+    return &instance;
+}
+
+/*static*/ void ItemUpgradeProfiler::SetEnabled(bool value)
+{
+    enabled.store(value, std::memory_order_relaxed);
+}
+
+void ItemUpgradeProfiler::Record(ItemUpgradeProfilePoint point, uint64 nanoseconds)
+{
+    Histogram& histogram = histograms[point];
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.total.fetch_add(nanoseconds, std::memory_order_relaxed);
+    histogram.buckets[BucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64 max = histogram.max.load(std::memory_order_relaxed);
+    while (nanoseconds > max && !histogram.max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed));
+}
+
+ItemUpgradeProfiler::Summary ItemUpgradeProfiler::Summarize(ItemUpgradeProfilePoint point) const
+{
+    const Histogram& histogram = histograms[point];
+
+    Summary summary;
+    summary.max = histogram.max.load(std::memory_order_relaxed);
+
+    // buckets are the source of truth for percentiles, count is only read for the mean
+    uint64 bucketCount = 0;
+    for (const std::atomic<uint64>& bucket : histogram.buckets)
+        bucketCount += bucket.load(std::memory_order_relaxed);
+
+    summary.count = histogram.count.load(std::memory_order_relaxed);
+    summary.mean = summary.count > 0 ? histogram.total.load(std::memory_order_relaxed) / summary.count : 0;
+    summary.p50 = ValueAtPercentile(histogram, bucketCount, 50.0);
+    summary.p90 = ValueAtPercentile(histogram, bucketCount, 90.0);
+    summary.p99 = ValueAtPercentile(histogram, bucketCount, 99.0);
+    summary.p999 = ValueAtPercentile(histogram, bucketCount, 99.9);
+    return summary;
+}
+
+void ItemUpgradeProfiler::Reset()
+{
+    for (Histogram& histogram : histograms)
+    {
+        histogram.count.store(0, std::memory_order_relaxed);
+        histogram.total.store(0, std::memory_order_relaxed);
+        histogram.max.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint64>& bucket : histogram.buckets)
+            bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64 ItemUpgradeProfiler::ValueAtPercentile(const Histogram& histogram, uint64 count, double percentile) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64 rank = std::max<uint64>(1, (uint64)std::ceil(percentile / 100.0 * count));
+    uint64 seen = 0;
+    for (uint32 i = 0; i < BUCKETS; i++)
+    {
+        seen += histogram.buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return std::min(BucketHighestValue(i), histogram.max.load(std::memory_order_relaxed));
+    }
+
+    return histogram.max.load(std::memory_order_relaxed);
+}
+
+/*static*/ uint32 ItemUpgradeProfiler::BucketIndex(uint64 value)
+{
+    value = std::min<uint64>(value, (uint64(1) << MAX_VALUE_BITS) - 1);
+    if (value < SUB_BUCKETS)
+        return (uint32)value;
+
+    // the SUB_BUCKET_BITS bits below the highest set bit select the bucket inside its power of two
+    uint32 shift = 63 - std::countl_zero(value) - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + (uint32)(value >> shift) - SUB_BUCKETS;
+}
+
+/*static*/ uint64 ItemUpgradeProfiler::BucketHighestValue(uint32 index)
+{
+    if (index < SUB_BUCKETS)
+        return index;
+
+    uint32 shift = index / SUB_BUCKETS - 1;
+    uint64 top = index % SUB_BUCKETS + SUB_BUCKETS;
+    return ((top + 1) << shift) - 1;
+}
+
+/*static*/ std::string ItemUpgradeProfiler::ProfilePointToString(ItemUpgradeProfilePoint point)
+{
+    switch (point)
+    {
+        case PROFILE_STAT_MODIFIER_SLOT:
+            return "HandleStatModifier (slot)";
+        case PROFILE_STAT_MODIFIER_ITEM:
+            return "HandleStatModifier (item)";
+        case PROFILE_WEAPON_MODIFIER:
+            return "HandleWeaponModifier";
+        case PROFILE_ITEM_REMOVE:
+            return "HandleItemRemove";
+        case PROFILE_RANDOM_UPGRADE:
+            return "ChooseRandomUpgrade";
+        case PROFILE_SEND_ITEM_PACKET:
+            return "SendItemPacket";
+        case PROFILE_UPDATE_VISUAL_CACHE:
+            return "UpdateVisualCache";
+        default:
+            return "";
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ * Credits: silviu20092
+ */
+
+#ifndef _ITEM_UPGRADE_PROFILER_H_
+#define _ITEM_UPGRADE_PROFILER_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include "Define.h"
+
+enum ItemUpgradeProfilePoint
+{
+    PROFILE_STAT_MODIFIER_SLOT = 0,
+    PROFILE_STAT_MODIFIER_ITEM,
+    PROFILE_WEAPON_MODIFIER,
+    PROFILE_ITEM_REMOVE,
+    PROFILE_RANDOM_UPGRADE,
+    PROFILE_SEND_ITEM_PACKET,
+    PROFILE_UPDATE_VISUAL_CACHE,
+    MAX_ITEM_UPGRADE_PROFILE_POINTS
+};
+
+/*
+ * Call counts and latency histograms of the hot paths, recorded from map threads too.
+ * Histograms use HDR style buckets: exact below 16 ns, then 16 buckets per power of two,
+ * so every recorded value is known within ~6% up to 2^40 ns.
+ * When disabled the only cost of a profiled call is one relaxed atomic load.
+ */
+class ItemUpgradeProfiler
+{
+private:
+    ItemUpgradeProfiler();
+    ~ItemUpgradeProfiler() = default;
+public:
+    static constexpr uint32 SUB_BUCKET_BITS = 4;
+    static constexpr uint32 SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr uint32 MAX_VALUE_BITS = 40;
+    static constexpr uint32 BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    struct Summary
+    {
+        uint64 count;
+        uint64 mean;
+        uint64 p50;
+        uint64 p90;
+        uint64 p99;
+        uint64 p999;
+        uint64 max;
+    };
+
+    static ItemUpgradeProfiler* instance();
+
+    static bool IsEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    static void SetEnabled(bool value);
+
+    void Record(ItemUpgradeProfilePoint point, uint64 nanoseconds);
+    Summary Summarize(ItemUpgradeProfilePoint point) const;
+    /* Calls recorded while resetting may be partly lost, good enough for counters that are only looked at by GMs */
+    void Reset();
+
+    static std::string ProfilePointToString(ItemUpgradeProfilePoint point);
+    static uint32 BucketIndex(uint64 value);
+    static uint64 BucketHighestValue(uint32 index);
+private:
+    struct Histogram
+    {
+        std::atomic<uint64> count;
+        std::atomic<uint64> total;
+        std::atomic<uint64> max;
+        std::array<std::atomic<uint64>, BUCKETS> buckets;
+    };
+
+    static std::atomic<bool> enabled;
+
+    std::array<Histogram, MAX_ITEM_UPGRADE_PROFILE_POINTS> histograms;
+
+    uint64 ValueAtPercentile(const Histogram& histogram, uint64 count, double percentile) const;
+};
+
+#define sItemUpgradeProfiler ItemUpgradeProfiler::instance()
+
+/* Records the time spent in the enclosing scope, nothing is measured unless the profiler was enabled when entering it */
+class ItemUpgradeProfileScope
+{
+public:
+    explicit ItemUpgradeProfileScope(ItemUpgradeProfilePoint point) : point(point), active(ItemUpgradeProfiler::IsEnabled())
+    {
+        if (active)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~ItemUpgradeProfileScope()
+    {
+        if (active)
+            sItemUpgradeProfiler->Record(point, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    ItemUpgradeProfileScope(const ItemUpgradeProfileScope&) = delete;
+    ItemUpgradeProfileScope& operator=(const ItemUpgradeProfileScope&) = delete;
+private:
+    ItemUpgradeProfilePoint point;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif
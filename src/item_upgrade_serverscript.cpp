@@ -0,0 +1,32 @@
+/*
+ * Credits: silviu20092
+ */
+
+#include "ScriptMgr.h"
+#include "WorldSession.h"
+#include "WorldPacket.h"
+#include "item_upgrade.h"
+
+class item_upgrade_serverscript : public ServerScript
+{
+public:
+    item_upgrade_serverscript() : ServerScript("item_upgrade_serverscript",
+        {
+            SERVERHOOK_CAN_PACKET_SEND
+        }) {}
+
+    bool CanPacketSend(WorldSession* session, WorldPacket& packet) override
+    {
+        // bank item packets are not sent at login, only the first time the player opens a banker
+        if (packet.GetOpcode() == SMSG_SHOW_BANK && sItemUpgrade->GetBoolConfig(CONFIG_ITEM_UPGRADE_SEND_PACKETS))
+            if (Player* player = session->GetPlayer())
+                sItemUpgrade->QueueBankVisualCacheUpdate(player);
+
+        return true;
+    }
+};
+
+void AddSC_item_upgrade_serverscript()
+{
+    new item_upgrade_serverscript();
+}
@@ -12,24 +12,17 @@ public:
     item_upgrade_worldscript() : WorldScript("item_upgrade_worldscript",
         {
             WORLDHOOK_ON_AFTER_CONFIG_LOAD,
-            WORLDHOOK_ON_BEFORE_WORLD_INITIALIZED
+            WORLDHOOK_ON_BEFORE_WORLD_INITIALIZED,
+            WORLDHOOK_ON_UPDATE,
+            WORLDHOOK_ON_SHUTDOWN
         }) {}
 
     void OnAfterConfigLoad(bool reload) override
     {
         if (reload)
-        {
-            ItemUpgrade::PagedDataMap& pagedData = sItemUpgrade->GetPagedDataMap();
-            for (auto& itr : pagedData)
-                itr.second.reloaded = true;
-
-            sItemUpgrade->HandleDataReload(false);
-        }
-
-        sItemUpgrade->LoadConfig(reload);
-
-        if (reload)
-            sItemUpgrade->HandleDataReload(true);
+            sItemUpgrade->ReloadConfig();
+        else
+            sItemUpgrade->LoadConfig(false);
     }
 
     void OnBeforeWorldInitialized() override
@@ -37,6 +30,20 @@ public:
         sItemUpgrade->LoadFromDB();
         sItemUpgrade->BuildWeaponUpgradeReqs();
     }
+
+    void OnUpdate(uint32 diff) override
+    {
+        sItemUpgrade->UpdateDefinitionsReload();
+        sItemUpgrade->UpdateModifierMigration();
+        sItemUpgrade->UpdateItemPacketQueue();
+        sItemUpgrade->UpdateMetrics(diff);
+    }
+
+    void OnShutdown() override
+    {
+        sItemUpgrade->WaitForDefinitionsReload();
+        sItemUpgrade->FlushUpgradeJournals();
+    }
 };
 
 void AddSC_item_upgrade_worldscript()
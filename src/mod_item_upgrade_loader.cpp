@@ -7,6 +7,7 @@ void AddSC_npc_item_upgrade();
 void AddSC_item_upgrade_commandscript();
 void AddSC_item_upgrade_playerscript();
 void AddSC_item_upgrade_itemscript();
+void AddSC_item_upgrade_serverscript();
 
 void Addmod_item_upgradeScripts()
 {
@@ -15,5 +16,6 @@ void Addmod_item_upgradeScripts()
     AddSC_item_upgrade_commandscript();
     AddSC_item_upgrade_playerscript();
     AddSC_item_upgrade_itemscript();
+    AddSC_item_upgrade_serverscript();
 }
 
@@ -53,6 +53,12 @@ public:
             return CloseGossip(player);
         }
 
+        if (!sItemUpgrade->IsCharacterUpgradeDataLoaded(player))
+        {
+            ItemUpgrade::SendMessage(player, "Your item upgrades are still being loaded, please retry.");
+            return CloseGossip(player);
+        }
+
         sItemUpgrade->GetPagedData(player).reloaded = false;
 
         if (!sItemUpgrade->GetBoolConfig(CONFIG_ITEM_UPGRADE_ENABLED))
@@ -85,6 +91,12 @@ public:
             return CloseGossip(player, false);
         }
 
+        if (!sItemUpgrade->IsCharacterUpgradeDataLoaded(player))
+        {
+            ItemUpgrade::SendMessage(player, "Your item upgrades are still being loaded, please retry.");
+            return CloseGossip(player, false);
+        }
+
         if (sender == GOSSIP_SENDER_MAIN)
         {
             if (action == GOSSIP_ACTION_INFO_DEF)
@@ -106,7 +118,7 @@ public:
             }
             else if (action == GOSSIP_ACTION_INFO_DEF + 4)
             {
-                sItemUpgrade->UpdateVisualCache(player);
+                sItemUpgrade->UpdateVisualCache(player, true);
                 sItemUpgrade->VisualFeedback(player);
                 return CloseGossip(player);
             }